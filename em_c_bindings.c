@@ -2,6 +2,7 @@
 #include "em_c_bindings.h"
 #include "eso_stack.h"
 #include "eso_debug.h"
+#include "eso_collect.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -25,6 +26,31 @@ void debug_leakcheck(em_state* state) {
     assert_no_leak(state);
 }
 
+void memory_collect(em_state* state) {
+    em_collect_cycles(state);
+}
+
+// Whether some of mptr's bytes are addresses of other objects (which differ from run
+// to run)
+static bool holds_addresses(em_managed_ptr* mptr) {
+
+    if (mptr->is_array) {
+        return is_code_using_managed_memory(mptr->array_element_code);
+    }
+
+    if (mptr->concrete_type != NULL) {
+
+        for (int field = 0; field < strlen(mptr->concrete_type->types); field++) {
+
+            if (is_code_using_managed_memory(mptr->concrete_type->types[field])) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
 void stdio_print_bytes(em_state* state) {
      em_stack_item* bytes = stack_top(state);
 
@@ -37,7 +63,11 @@ void stdio_print_bytes(em_state* state) {
         return;
     } 
 
-    printf("%db = ", bytes->u.v_mptr->size);
+    if (holds_addresses(bytes->u.v_mptr)) {
+        printf("%db with addresses = ", bytes->u.v_mptr->size);
+    } else {
+        printf("%db = ", bytes->u.v_mptr->size);
+    }
 
     for (int i = 0; i < bytes->u.v_mptr->size; i++) {
         printf("%d", (int)*(char*)(bytes->u.v_mptr->raw + i));
@@ -70,12 +100,9 @@ void string_cat(em_state* state) {
     int a_nonul_size = (a->u.v_mptr->size - 1);
     int b_nonul_size = (b->u.v_mptr->size - 1);
 
-    em_managed_ptr* mptr = create_managed_ptr(state);
-
-    mptr->size =  a_nonul_size + b_nonul_size + 1; 
-    mptr->raw = em_usercode_alloc(state, mptr->size, false);
+    em_managed_ptr* mptr = create_managed_ptr(state, a_nonul_size + b_nonul_size + 1);
     mptr->concrete_type = NULL;
-    em_add_reference(state, mptr); // Stack holds a reference
+    em_add_stack_reference(state, mptr); // Stack holds a reference
     memset(mptr->raw, 0, mptr->size);
 
     memcpy(mptr->raw, a->u.v_mptr->raw, a_nonul_size);
@@ -94,4 +121,5 @@ void em_bind_c_default(em_state* state) {
     em_bind_c_call(state, "stdio.print_bytes", stdio_print_bytes);
     em_bind_c_call(state, "debug.assert_no_leak", debug_leakcheck);
     em_bind_c_call(state, "string.cat", string_cat);
+    em_bind_c_call(state, "memory.collect", memory_collect);
 }
@@ -11,451 +11,510 @@
 #include <stdarg.h> 
 #include <stdbool.h>
 
-int run_boolean(em_state* state) {
+// Which of the six typed forms (starting at first) handles operands of code. Anything
+// else (a location) stays generic: no typed form would ever accept it
+static uint16_t typed_opcode(uint16_t generic, uint16_t first, char code) {
+    switch(code) {
+        case '1': return first;
+        case '2': return first + 1;
+        case '4': return first + 2;
+        case '8': return first + 3;
+        case 'f': return first + 4;
+        case 'd': return first + 5;
+    }
 
-    char current_code = tolower(state->code[state->index]);
+    return generic;
+}
 
-    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", current_code);
-    log_ingestion(current_code);
+int run_boolean_add(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", inst->code);
+    log_ingestion(inst->code);
 
-    switch(current_code) {
-        // add
-        case '+': 
-        {
-            em_stack_item* one = stack_top_minus(state, 1);
-            em_stack_item* two = stack_top(state);
+    em_stack_item* one = stack_top_minus(state, 1);
+    em_stack_item* two = stack_top(state);
 
-            if (one == NULL || two == NULL) {
-                em_panic(state, "Operation add requires two items on the stack to add");
-            }
+    if (one == NULL || two == NULL) {
+        em_panic(state, "Operation add requires two items on the stack to add");
+    }
 
-            if (!is_stack_item_numeric(one) || !is_stack_item_numeric(two)) {
-                em_panic(state, 
-                    "Operation add requires two arguments of numeric type. Got %c and %c", one->code, two->code);
+    if (!is_stack_item_numeric(one) || !is_stack_item_numeric(two)) {
+        em_panic(state,
+            "Operation add requires two arguments of numeric type. Got %c and %c", one->code, two->code);
+    }
+
+    // Both operands are the same type if this succeeds: the site is then
+    // rewritten to the typed form for it
+    uint16_t typed = typed_opcode(EM_OP_BOOLEAN_ADD, EM_OP_BOOLEAN_ADD_U8, two->code);
+
+    stack_pop(state);
+    stack_pop(state);
+
+    switch(one->code) {
+        case '1':
+            switch(two->code) {
+                case '1':  {
+                    uint8_t op = one->u.v_byte + two->u.v_byte;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '1';
+                    state->stack[ptr].u.v_byte = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
             }
+        break;
 
-            stack_pop(state);
-            stack_pop(state);
-
-            switch(one->code) {
-                case '1': 
-                    switch(two->code) { 
-                        case '1':  {            
-                            uint8_t op = one->u.v_byte + two->u.v_byte;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '1';
-                            state->stack[ptr].u.v_byte = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break; 
-                
-                case '2': 
-                    switch(two->code) { 
-                        case '2':  {    
-                            uint16_t op = one->u.v_int16 + two->u.v_int16;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '2';
-                            state->stack[ptr].u.v_int16 = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case '4': 
-                    switch(two->code) { 
-                        case '4':  {                            
-                            uint32_t op = one->u.v_int32 + two->u.v_int32;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '4';
-                            state->stack[ptr].u.v_int32 = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case '8': 
-                    switch(two->code) { 
-                        case '8':  {                            
-                            uint64_t op =one->u.v_int64 + two->u.v_int64;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '8';
-                            state->stack[ptr].u.v_int64 = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case 'f': 
-                    switch(two->code) { 
-                        case 'f':  {                            
-                            float op = one->u.v_float + two->u.v_float;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = 'f';
-                            state->stack[ptr].u.v_float = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }   
-                break;
-
-                case 'd': 
-                    switch(two->code) { 
-                        case 'd':  {                            
-                            double op = one->u.v_double + two->u.v_double;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = 'd';
-                            state->stack[ptr].u.v_double = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }   
+        case '2':
+            switch(two->code) {
+                case '2':  {
+                    uint16_t op = one->u.v_int16 + two->u.v_int16;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '2';
+                    state->stack[ptr].u.v_int16 = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
                 break;
             }
+        break;
 
-        }
+        case '4':
+            switch(two->code) {
+                case '4':  {
+                    uint32_t op = one->u.v_int32 + two->u.v_int32;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '4';
+                    state->stack[ptr].u.v_int32 = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
         break;
 
-        // and
-        case 'a': 
-        {
-            em_stack_item* one = stack_top_minus(state, 1);
-            em_stack_item* two = stack_top(state);
+        case '8':
+            switch(two->code) {
+                case '8':  {
+                    uint64_t op =one->u.v_int64 + two->u.v_int64;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '8';
+                    state->stack[ptr].u.v_int64 = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
 
-            if (one == NULL || two == NULL) {
-                em_panic(state, "Operation and requires two items on the stack");
+        case 'f':
+            switch(two->code) {
+                case 'f':  {
+                    float op = one->u.v_float + two->u.v_float;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = 'f';
+                    state->stack[ptr].u.v_float = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
             }
+        break;
 
-            if (one->code != '?' || two->code != '?') {
-                em_panic(state, 
-                    "Operation and requires two arguments of ? (boolean) type. Got %c and %c", one->code, two->code);
+        case 'd':
+            switch(two->code) {
+                case 'd':  {
+                    double op = one->u.v_double + two->u.v_double;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = 'd';
+                    state->stack[ptr].u.v_double = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot add a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
             }
+        break;
+    }
 
-            stack_pop(state);
-            stack_pop(state);
+    inst->opcode = typed;
 
-            bool op = one->u.v_bool && two->u.v_bool;
+    return inst->next;
+}
 
-            int ptr = stack_push(state);
-            state->stack[ptr].code = '?';
-            state->stack[ptr].u.v_bool = op;
-        }
-        break;
+int run_boolean_and(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", inst->code);
+    log_ingestion(inst->code);
 
-        // or
-        case 'o': 
-        {
-            em_stack_item* one = stack_top_minus(state, 1);
-            em_stack_item* two = stack_top(state);
+    em_stack_item* one = stack_top_minus(state, 1);
+    em_stack_item* two = stack_top(state);
 
-            if (one == NULL || two == NULL) {
-                em_panic(state, "Operation or requires two items on the stack");
-            }
+    if (one == NULL || two == NULL) {
+        em_panic(state, "Operation and requires two items on the stack");
+    }
 
-            if (one->code != '?' || two->code != '?') {
-                em_panic(state, 
-                    "Operation or requires two arguments of ? (boolean) type. Got %c and %c", one->code, two->code);
-            }
+    if (one->code != '?' || two->code != '?') {
+        em_panic(state,
+            "Operation and requires two arguments of ? (boolean) type. Got %c and %c", one->code, two->code);
+    }
 
-            stack_pop(state);
-            stack_pop(state);
+    stack_pop(state);
+    stack_pop(state);
 
-            bool op = one->u.v_bool || two->u.v_bool;
+    bool op = one->u.v_bool && two->u.v_bool;
 
-            int ptr = stack_push(state);
-            state->stack[ptr].code = '?';
-            state->stack[ptr].u.v_bool = op;
-        }
-        break;
+    int ptr = stack_push(state);
+    state->stack[ptr].code = '?';
+    state->stack[ptr].u.v_bool = op;
 
-        // not
-        case '!': 
-        {
-            em_stack_item* one = stack_top(state);
-          
-            if (one == NULL) {
-                em_panic(state, "Operation not requires an item on top of the stack");
-            }
+    return inst->next;
+}
 
-            if (one->code != '?') {
-                em_panic(state, 
-                    "Operation not requires one argument of ? (boolean) type. Got %c", one->code);
-            }
+int run_boolean_or(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", inst->code);
+    log_ingestion(inst->code);
 
-            stack_pop(state);
+    em_stack_item* one = stack_top_minus(state, 1);
+    em_stack_item* two = stack_top(state);
 
-            bool op = !one->u.v_bool;
+    if (one == NULL || two == NULL) {
+        em_panic(state, "Operation or requires two items on the stack");
+    }
 
-            int ptr = stack_push(state);
-            state->stack[ptr].code = '?';
-            state->stack[ptr].u.v_bool = op;
-        }
-        break;
+    if (one->code != '?' || two->code != '?') {
+        em_panic(state,
+            "Operation or requires two arguments of ? (boolean) type. Got %c and %c", one->code, two->code);
+    }
 
-        // subtract
-        case '-': break;
+    stack_pop(state);
+    stack_pop(state);
 
-        // multiply
-        case '*': break;
+    bool op = one->u.v_bool || two->u.v_bool;
 
-        // divide
-        case '/': break;
+    int ptr = stack_push(state);
+    state->stack[ptr].code = '?';
+    state->stack[ptr].u.v_bool = op;
 
-        // mod
-        case '%': break;
+    return inst->next;
+}
 
-        // logical not
-        case '~': break;
+int run_boolean_not(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", inst->code);
+    log_ingestion(inst->code);
 
-        // and
-        case '&': break;
+    em_stack_item* one = stack_top(state);
 
-        // less than
-        case '<': 
-        {
-            em_stack_item* one = stack_top_minus(state, 1);
-            em_stack_item* two = stack_top(state);
+    if (one == NULL) {
+        em_panic(state, "Operation not requires an item on top of the stack");
+    }
 
-            if (one == NULL || two == NULL) {
-                em_panic(state, "Operation less than requires two items on the stack to compare");
-            }
+    if (one->code != '?') {
+        em_panic(state,
+            "Operation not requires one argument of ? (boolean) type. Got %c", one->code);
+    }
 
-            if (!is_stack_item_numeric(one) || !is_stack_item_numeric(two)) {
-                em_panic(state, 
-                    "Operation less than requires two arguments of numeric type. Got %c and %c", one->code, two->code);
+    stack_pop(state);
+
+    bool op = !one->u.v_bool;
+
+    int ptr = stack_push(state);
+    state->stack[ptr].code = '?';
+    state->stack[ptr].u.v_bool = op;
+
+    return inst->next;
+}
+
+int run_boolean_less(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", inst->code);
+    log_ingestion(inst->code);
+
+    em_stack_item* one = stack_top_minus(state, 1);
+    em_stack_item* two = stack_top(state);
+
+    if (one == NULL || two == NULL) {
+        em_panic(state, "Operation less than requires two items on the stack to compare");
+    }
+
+    if (!is_stack_item_numeric(one) || !is_stack_item_numeric(two)) {
+        em_panic(state,
+            "Operation less than requires two arguments of numeric type. Got %c and %c", one->code, two->code);
+    }
+
+    // Both operands are the same type if this succeeds: the site is then
+    // rewritten to the typed form for it
+    uint16_t typed = typed_opcode(EM_OP_BOOLEAN_LESS, EM_OP_BOOLEAN_LESS_U8, two->code);
+
+    stack_pop(state);
+    stack_pop(state);
+
+    switch(one->code) {
+        case '1':
+            switch(two->code) {
+                case '1':  {
+                    bool op = one->u.v_byte < two->u.v_byte;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
             }
+        break;
 
-            stack_pop(state);
-            stack_pop(state);
-
-            switch(one->code) {
-                case '1': 
-                    switch(two->code) { 
-                        case '1':  {            
-                            bool op = one->u.v_byte < two->u.v_byte;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break; 
-                
-                case '2': 
-                    switch(two->code) { 
-                        case '2':  {    
-                            bool op = one->u.v_int16 < two->u.v_int16;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case '4': 
-                    switch(two->code) { 
-                        case '4':  {                            
-                            bool op = one->u.v_int32 < two->u.v_int32;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case '8': 
-                    switch(two->code) { 
-                        case '8':  {                            
-                            bool op =one->u.v_int64 < two->u.v_int64;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case 'f': 
-                    switch(two->code) { 
-                        case 'f':  {                            
-                            bool op = one->u.v_float < two->u.v_float;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }   
-                break;
-
-                case 'd': 
-                    switch(two->code) { 
-                        case 'd':  {                            
-                            bool op = one->u.v_double < two->u.v_double;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }   
+        case '2':
+            switch(two->code) {
+                case '2':  {
+                    bool op = one->u.v_int16 < two->u.v_int16;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
                 break;
             }
-        }
         break;
 
-        // greater than
-        case '>': 
-        {
-            em_stack_item* one = stack_top_minus(state, 1);
-            em_stack_item* two = stack_top(state);
+        case '4':
+            switch(two->code) {
+                case '4':  {
+                    bool op = one->u.v_int32 < two->u.v_int32;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
 
-            if (one == NULL || two == NULL) {
-                em_panic(state, "Operation greater than requires two items on the stack to compare");
+        case '8':
+            switch(two->code) {
+                case '8':  {
+                    bool op =one->u.v_int64 < two->u.v_int64;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
             }
+        break;
 
-            if (!is_stack_item_numeric(one) || !is_stack_item_numeric(two)) {
-                em_panic(state, 
-                    "Operation greater than requires two arguments of numeric type. Got %c and %c", one->code, two->code);
+        case 'f':
+            switch(two->code) {
+                case 'f':  {
+                    bool op = one->u.v_float < two->u.v_float;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
             }
+        break;
 
-            stack_pop(state);
-            stack_pop(state);
-
-            switch(one->code) {
-                case '1': 
-                    switch(two->code) { 
-                        case '1':  {            
-                            bool op = one->u.v_byte > two->u.v_byte;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break; 
-                
-                case '2': 
-                    switch(two->code) { 
-                        case '2':  {    
-                            bool op = one->u.v_int16 > two->u.v_int16;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case '4': 
-                    switch(two->code) { 
-                        case '4':  {                            
-                            bool op = one->u.v_int32 > two->u.v_int32;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case '8': 
-                    switch(two->code) { 
-                        case '8':  {                            
-                            bool op =one->u.v_int64 > two->u.v_int64;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }
-                break;
-                
-                case 'f': 
-                    switch(two->code) { 
-                        case 'f':  {                            
-                            bool op = one->u.v_float > two->u.v_float;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }   
-                break;
-
-                case 'd': 
-                    switch(two->code) { 
-                        case 'd':  {                            
-                            bool op = one->u.v_double > two->u.v_double;
-                            int ptr = stack_push(state);
-                            state->stack[ptr].code = '?';
-                            state->stack[ptr].u.v_bool = op;
-                        }
-                        break;
-                        default:
-                        em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
-                        break;
-                    }   
+        case 'd':
+            switch(two->code) {
+                case 'd':  {
+                    bool op = one->u.v_double < two->u.v_double;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
                 break;
             }
-        }
         break;
+    }
+
+    inst->opcode = typed;
+
+    return inst->next;
+}
 
-        default:
-            em_panic(state, "Unknown boolean instruction %c", current_code);
-            return 0;
+int run_boolean_greater(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", inst->code);
+    log_ingestion(inst->code);
+
+    em_stack_item* one = stack_top_minus(state, 1);
+    em_stack_item* two = stack_top(state);
+
+    if (one == NULL || two == NULL) {
+        em_panic(state, "Operation greater than requires two items on the stack to compare");
+    }
 
+    if (!is_stack_item_numeric(one) || !is_stack_item_numeric(two)) {
+        em_panic(state,
+            "Operation greater than requires two arguments of numeric type. Got %c and %c", one->code, two->code);
     }
 
-    return 0;
+    // Both operands are the same type if this succeeds: the site is then
+    // rewritten to the typed form for it
+    uint16_t typed = typed_opcode(EM_OP_BOOLEAN_GREATER, EM_OP_BOOLEAN_GREATER_U8, two->code);
+
+    stack_pop(state);
+    stack_pop(state);
+
+    switch(one->code) {
+        case '1':
+            switch(two->code) {
+                case '1':  {
+                    bool op = one->u.v_byte > two->u.v_byte;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
+
+        case '2':
+            switch(two->code) {
+                case '2':  {
+                    bool op = one->u.v_int16 > two->u.v_int16;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
+
+        case '4':
+            switch(two->code) {
+                case '4':  {
+                    bool op = one->u.v_int32 > two->u.v_int32;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
+
+        case '8':
+            switch(two->code) {
+                case '8':  {
+                    bool op =one->u.v_int64 > two->u.v_int64;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
+
+        case 'f':
+            switch(two->code) {
+                case 'f':  {
+                    bool op = one->u.v_float > two->u.v_float;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
+
+        case 'd':
+            switch(two->code) {
+                case 'd':  {
+                    bool op = one->u.v_double > two->u.v_double;
+                    int ptr = stack_push(state);
+                    state->stack[ptr].code = '?';
+                    state->stack[ptr].u.v_bool = op;
+                }
+                break;
+                default:
+                em_panic(state, "Cannot compare a number of type %c to a number of type %c without a cast", one->code, two->code);
+                break;
+            }
+        break;
+    }
 
-}
\ No newline at end of file
+    inst->opcode = typed;
+
+    return inst->next;
+}
+
+// Quickened forms of add/less/greater. A site that has run is rewritten to the one
+// for the type it saw, which skips the checks and type switches. If the operands
+// are ever not both of that type the site goes back to the generic form
+#define EM_TYPED_BINARY(name, generic, generic_opcode, type_code, field, result_code, result_field, operator) \
+int name(em_state* state, em_instruction* inst) { \
+\
+    if (state->stack_ptr < 1 || \
+        state->stack[state->stack_ptr - 1].code != type_code || \
+        state->stack[state->stack_ptr].code != type_code) { \
+        inst->opcode = generic_opcode; \
+        return generic(state, inst); \
+    } \
+\
+    log_verbose("\033[0;31m%c\033[0;0m (Boolean)\n", inst->code); \
+    log_ingestion(inst->code); \
+\
+    em_stack_item* one = &state->stack[state->stack_ptr - 1]; \
+    em_stack_item* two = &state->stack[state->stack_ptr]; \
+\
+    em_stack_item result; \
+    memset(&result, 0, sizeof(em_stack_item)); \
+    result.code = result_code; \
+    result.u.result_field = one->u.field operator two->u.field; \
+\
+    *one = result; \
+    state->stack_ptr--; \
+\
+    return inst->next; \
+}
+
+EM_TYPED_BINARY(run_boolean_add_u8, run_boolean_add, EM_OP_BOOLEAN_ADD, '1', v_byte, '1', v_byte, +)
+EM_TYPED_BINARY(run_boolean_add_u16, run_boolean_add, EM_OP_BOOLEAN_ADD, '2', v_int16, '2', v_int16, +)
+EM_TYPED_BINARY(run_boolean_add_u32, run_boolean_add, EM_OP_BOOLEAN_ADD, '4', v_int32, '4', v_int32, +)
+EM_TYPED_BINARY(run_boolean_add_u64, run_boolean_add, EM_OP_BOOLEAN_ADD, '8', v_int64, '8', v_int64, +)
+EM_TYPED_BINARY(run_boolean_add_f32, run_boolean_add, EM_OP_BOOLEAN_ADD, 'f', v_float, 'f', v_float, +)
+EM_TYPED_BINARY(run_boolean_add_f64, run_boolean_add, EM_OP_BOOLEAN_ADD, 'd', v_double, 'd', v_double, +)
+
+EM_TYPED_BINARY(run_boolean_less_u8, run_boolean_less, EM_OP_BOOLEAN_LESS, '1', v_byte, '?', v_bool, <)
+EM_TYPED_BINARY(run_boolean_less_u16, run_boolean_less, EM_OP_BOOLEAN_LESS, '2', v_int16, '?', v_bool, <)
+EM_TYPED_BINARY(run_boolean_less_u32, run_boolean_less, EM_OP_BOOLEAN_LESS, '4', v_int32, '?', v_bool, <)
+EM_TYPED_BINARY(run_boolean_less_u64, run_boolean_less, EM_OP_BOOLEAN_LESS, '8', v_int64, '?', v_bool, <)
+EM_TYPED_BINARY(run_boolean_less_f32, run_boolean_less, EM_OP_BOOLEAN_LESS, 'f', v_float, '?', v_bool, <)
+EM_TYPED_BINARY(run_boolean_less_f64, run_boolean_less, EM_OP_BOOLEAN_LESS, 'd', v_double, '?', v_bool, <)
+
+EM_TYPED_BINARY(run_boolean_greater_u8, run_boolean_greater, EM_OP_BOOLEAN_GREATER, '1', v_byte, '?', v_bool, >)
+EM_TYPED_BINARY(run_boolean_greater_u16, run_boolean_greater, EM_OP_BOOLEAN_GREATER, '2', v_int16, '?', v_bool, >)
+EM_TYPED_BINARY(run_boolean_greater_u32, run_boolean_greater, EM_OP_BOOLEAN_GREATER, '4', v_int32, '?', v_bool, >)
+EM_TYPED_BINARY(run_boolean_greater_u64, run_boolean_greater, EM_OP_BOOLEAN_GREATER, '8', v_int64, '?', v_bool, >)
+EM_TYPED_BINARY(run_boolean_greater_f32, run_boolean_greater, EM_OP_BOOLEAN_GREATER, 'f', v_float, '?', v_bool, >)
+EM_TYPED_BINARY(run_boolean_greater_f64, run_boolean_greater, EM_OP_BOOLEAN_GREATER, 'd', v_double, '?', v_bool, >)
\ No newline at end of file
@@ -1,2 +1,28 @@
 #pragma once
-int run_boolean(em_state* state);
\ No newline at end of file
+int run_boolean_add(em_state* state, em_instruction* inst);
+int run_boolean_and(em_state* state, em_instruction* inst);
+int run_boolean_or(em_state* state, em_instruction* inst);
+int run_boolean_not(em_state* state, em_instruction* inst);
+int run_boolean_less(em_state* state, em_instruction* inst);
+int run_boolean_greater(em_state* state, em_instruction* inst);
+
+int run_boolean_add_u8(em_state* state, em_instruction* inst);
+int run_boolean_add_u16(em_state* state, em_instruction* inst);
+int run_boolean_add_u32(em_state* state, em_instruction* inst);
+int run_boolean_add_u64(em_state* state, em_instruction* inst);
+int run_boolean_add_f32(em_state* state, em_instruction* inst);
+int run_boolean_add_f64(em_state* state, em_instruction* inst);
+
+int run_boolean_less_u8(em_state* state, em_instruction* inst);
+int run_boolean_less_u16(em_state* state, em_instruction* inst);
+int run_boolean_less_u32(em_state* state, em_instruction* inst);
+int run_boolean_less_u64(em_state* state, em_instruction* inst);
+int run_boolean_less_f32(em_state* state, em_instruction* inst);
+int run_boolean_less_f64(em_state* state, em_instruction* inst);
+
+int run_boolean_greater_u8(em_state* state, em_instruction* inst);
+int run_boolean_greater_u16(em_state* state, em_instruction* inst);
+int run_boolean_greater_u32(em_state* state, em_instruction* inst);
+int run_boolean_greater_u64(em_state* state, em_instruction* inst);
+int run_boolean_greater_f32(em_state* state, em_instruction* inst);
+int run_boolean_greater_f64(em_state* state, em_instruction* inst);
\ No newline at end of file
@@ -0,0 +1,893 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "eso_vm.h"
+#include "eso_log.h"
+#include "eso_parse.h"
+#include "eso_bytecode.h"
+#include "eso_udt.h"
+#include "eso_stack.h"
+#include "eso_debug.h"
+#include "eso_literal.h"
+#include "eso_boolean.h"
+#include "eso_memory.h"
+#include "eso_controlflow.h"
+#include "eso_c.h"
+#include "eso_fusion.h"
+#include "eso_jit.h"
+#include "eso_collect.h"
+
+// Marks a source index from which only whitespace/comments remain
+#define EM_INSTRUCTION_AT_END -2
+
+// Every opcode and the handler which runs it
+#define EM_OPCODES(X) \
+    X(EM_OP_MODE, run_mode_change) \
+    X(EM_OP_LITERAL_BOOL, run_literal_bool) \
+    X(EM_OP_LITERAL_U8, run_literal_u8) \
+    X(EM_OP_LITERAL_U16, run_literal_u16) \
+    X(EM_OP_LITERAL_U32, run_literal_u32) \
+    X(EM_OP_LITERAL_U64, run_literal_u64) \
+    X(EM_OP_LITERAL_F32, run_literal_f32) \
+    X(EM_OP_LITERAL_F64, run_literal_f64) \
+    X(EM_OP_LITERAL_STRING, run_literal_string) \
+    X(EM_OP_LITERAL_NULL, run_literal_null) \
+    X(EM_OP_BOOLEAN_ADD, run_boolean_add) \
+    X(EM_OP_BOOLEAN_AND, run_boolean_and) \
+    X(EM_OP_BOOLEAN_OR, run_boolean_or) \
+    X(EM_OP_BOOLEAN_NOT, run_boolean_not) \
+    X(EM_OP_BOOLEAN_LESS, run_boolean_less) \
+    X(EM_OP_BOOLEAN_GREATER, run_boolean_greater) \
+    X(EM_OP_BOOLEAN_ADD_U8, run_boolean_add_u8) \
+    X(EM_OP_BOOLEAN_ADD_U16, run_boolean_add_u16) \
+    X(EM_OP_BOOLEAN_ADD_U32, run_boolean_add_u32) \
+    X(EM_OP_BOOLEAN_ADD_U64, run_boolean_add_u64) \
+    X(EM_OP_BOOLEAN_ADD_F32, run_boolean_add_f32) \
+    X(EM_OP_BOOLEAN_ADD_F64, run_boolean_add_f64) \
+    X(EM_OP_BOOLEAN_LESS_U8, run_boolean_less_u8) \
+    X(EM_OP_BOOLEAN_LESS_U16, run_boolean_less_u16) \
+    X(EM_OP_BOOLEAN_LESS_U32, run_boolean_less_u32) \
+    X(EM_OP_BOOLEAN_LESS_U64, run_boolean_less_u64) \
+    X(EM_OP_BOOLEAN_LESS_F32, run_boolean_less_f32) \
+    X(EM_OP_BOOLEAN_LESS_F64, run_boolean_less_f64) \
+    X(EM_OP_BOOLEAN_GREATER_U8, run_boolean_greater_u8) \
+    X(EM_OP_BOOLEAN_GREATER_U16, run_boolean_greater_u16) \
+    X(EM_OP_BOOLEAN_GREATER_U32, run_boolean_greater_u32) \
+    X(EM_OP_BOOLEAN_GREATER_U64, run_boolean_greater_u64) \
+    X(EM_OP_BOOLEAN_GREATER_F32, run_boolean_greater_f32) \
+    X(EM_OP_BOOLEAN_GREATER_F64, run_boolean_greater_f64) \
+    X(EM_OP_MEMORY_ALLOCATE, run_memory_allocate) \
+    X(EM_OP_MEMORY_ARRAY, run_memory_array) \
+    X(EM_OP_MEMORY_LENGTH, run_memory_length) \
+    X(EM_OP_MEMORY_ELEMENTS, run_memory_elements) \
+    X(EM_OP_MEMORY_COPY, run_memory_copy) \
+    X(EM_OP_MEMORY_SET, run_memory_set) \
+    X(EM_OP_MEMORY_GET, run_memory_get) \
+    X(EM_OP_MEMORY_REGION_OPEN, run_memory_region_open) \
+    X(EM_OP_MEMORY_REGION_CLOSE, run_memory_region_close) \
+    X(EM_OP_STACK_POP, run_stack_pop) \
+    X(EM_OP_STACK_DUPLICATE, run_stack_duplicate) \
+    X(EM_OP_STACK_COPY, run_stack_copy) \
+    X(EM_OP_STACK_POP_BENEATH, run_stack_pop_beneath) \
+    X(EM_OP_C_CALL, run_c_call) \
+    X(EM_OP_DEBUG_STACK, run_debug_stack) \
+    X(EM_OP_DEBUG_TRACE, run_debug_trace) \
+    X(EM_OP_DEBUG_TYPES, run_debug_types) \
+    X(EM_OP_DEBUG_MEMORY, run_debug_memory) \
+    X(EM_OP_DEBUG_INSPECT, run_debug_inspect) \
+    X(EM_OP_DEBUG_ASSERT_LINE, run_debug_assert_line) \
+    X(EM_OP_DEBUG_ASSERT, run_debug_assert) \
+    X(EM_OP_DEBUG_FUSIONS, run_debug_fusions) \
+    X(EM_OP_DEBUG_COLLECT, run_debug_collect) \
+    X(EM_OP_UDT_CREATE, run_udt_create) \
+    X(EM_OP_UDT_GET, run_udt_get) \
+    X(EM_OP_UDT_SET, run_udt_set) \
+    X(EM_OP_UDT_DEFINE, run_udt_define) \
+    X(EM_OP_CONTROL_MARKER, run_control_marker) \
+    X(EM_OP_CONTROL_EXIT, run_control_exit) \
+    X(EM_OP_CONTROL_LABEL, run_control_label) \
+    X(EM_OP_CONTROL_FORWARD_DECLARE, run_control_forward_declare) \
+    X(EM_OP_CONTROL_JUMP, run_control_jump) \
+    X(EM_OP_CONTROL_GET_LABEL, run_control_get_label) \
+    X(EM_OP_CONTROL_IF, run_control_if) \
+    X(EM_OP_CONTROL_LINE, run_control_line) \
+    X(EM_OP_CONTROL_SET_TOKEN, run_control_set_token) \
+    X(EM_OP_CONTROL_REWIND, run_control_rewind) \
+    X(EM_OP_CONTROL_FAST_FORWARD, run_control_fast_forward) \
+    X(EM_OP_CONTROL_CALL, run_control_call) \
+    X(EM_OP_CONTROL_RETURN, run_control_return) \
+    X(EM_OP_FUSED_ADD_IMMEDIATE, run_fused_add_immediate) \
+    X(EM_OP_FUSED_GET_LABEL, run_fused_get_label) \
+    X(EM_OP_FUSED_STACK_COPY, run_fused_stack_copy) \
+    X(EM_OP_FUSED_COMPARE_BRANCH, run_fused_compare_branch) \
+    X(EM_OP_NOP, run_nop) \
+    X(EM_OP_UNKNOWN, run_unknown)
+
+em_op em_op_handlers[EM_OP_COUNT] = {
+    #define X(name, handler) [name] = handler,
+    EM_OPCODES(X)
+    #undef X
+};
+
+const char* em_op_handler_names[EM_OP_COUNT] = {
+    #define X(name, handler) [name] = #handler,
+    EM_OPCODES(X)
+    #undef X
+};
+
+int run_mode_change(em_state* state, em_instruction* inst) {
+
+    log_ingestion(inst->code);
+
+    char new_mode = safe_get(state->code, state->index+1, state->len);
+    state->last_mode_change = state->index;
+
+    log_ingestion(new_mode);
+
+    state->mode = inst->operand.mode;
+
+    log_verbose("\033[0;31m%c %c\033[0;0m (Mode change)\n", inst->code, new_mode);
+
+    return inst->next;
+}
+
+int run_nop(em_state* state, em_instruction* inst) {
+    log_ingestion(inst->code);
+    return inst->next;
+}
+
+int run_unknown(em_state* state, em_instruction* inst) {
+
+    log_ingestion(inst->code);
+
+    // Mode changes are valid in every mode so if this is one it's the mode that's wrong
+    if (tolower(inst->code) == 'm') {
+        em_panic(state, "Unknown mode change '%c'\n", safe_get(state->code, state->index+1, state->len));
+    }
+
+    switch(inst->mode) {
+        case EM_LITERAL: em_panic(state, "Unknown literal instruction %c", inst->code); break;
+        case EM_BOOLEAN: em_panic(state, "Unknown boolean instruction %c", inst->code); break;
+        case EM_MEMORY: em_panic(state, "Unknown memory instruction %c", inst->code); break;
+        case EM_STACK: em_panic(state, "Unknown stack instruction %c", inst->code); break;
+        case EM_CC: em_panic(state, "Unknown C interop instruction %c", inst->code); break;
+        case EM_DEBUG: em_panic(state, "Unknown debug instruction %c", inst->code); break;
+        case EM_UDT: em_panic(state, "Unknown UDT instruction %c", inst->code); break;
+        case EM_CONTROL_FLOW: em_panic(state, "Unknown control flow instruction %c", inst->code); break;
+    }
+
+    return inst->next;
+}
+
+// Whitespace and comments have no meaning in any mode
+static int skip_insignificant(em_state* state, int index) {
+
+    while (index < state->len) {
+
+        if (state->code[index] == '#') {
+            log_verbose("Terminating at comment at index %d\n", index);
+
+            while (index < state->len && state->code[index] != '\n') {
+                index++;
+            }
+
+            continue;
+        }
+
+        if (!isspace(state->code[index]) && state->code[index] != '\r') {
+            break;
+        }
+
+        index++;
+    }
+
+    return index;
+}
+
+static uint16_t decode_mode_change(char new_mode, ESOMODE* mode) {
+    switch(tolower(new_mode)) {
+        case 'b': *mode = EM_BOOLEAN; break;
+        case 'm': *mode = EM_MEMORY; break;
+        case 'l': *mode = EM_LITERAL; break;
+        case 's': *mode = EM_STACK; break;
+        case 'c': *mode = EM_CC; break;
+        case 'd': *mode = EM_DEBUG; break;
+        case 'u': *mode = EM_UDT; break;
+        case 'f': *mode = EM_CONTROL_FLOW; break;
+        default:
+            return EM_OP_UNKNOWN;
+    }
+
+    return EM_OP_MODE;
+}
+
+static uint16_t decode_opcode(char code, ESOMODE mode, uint8_t control_flow_token) {
+
+    // Unlike other modes control flow is case sensitive (the symbol could be anything)
+    if (mode == EM_CONTROL_FLOW) {
+
+        if (code == control_flow_token) {
+            return EM_OP_CONTROL_MARKER;
+        }
+
+        switch(code) {
+            case 'x': return EM_OP_CONTROL_EXIT;
+            case 'l': return EM_OP_CONTROL_LABEL;
+            case 'f': return EM_OP_CONTROL_FORWARD_DECLARE;
+            case 'j': return EM_OP_CONTROL_JUMP;
+            case 'g': return EM_OP_CONTROL_GET_LABEL;
+            case 'i': return EM_OP_CONTROL_IF;
+            case '$': return EM_OP_CONTROL_LINE;
+            case 's': return EM_OP_CONTROL_SET_TOKEN;
+            case '<': return EM_OP_CONTROL_REWIND;
+            case '>': return EM_OP_CONTROL_FAST_FORWARD;
+            case 'c': return EM_OP_CONTROL_CALL;
+            case 'r': return EM_OP_CONTROL_RETURN;
+        }
+
+        return EM_OP_UNKNOWN;
+    }
+
+    code = tolower(code);
+
+    switch(mode) {
+        case EM_LITERAL:
+            switch(code) {
+                case '?': return EM_OP_LITERAL_BOOL;
+                case '1': return EM_OP_LITERAL_U8;
+                case '2': return EM_OP_LITERAL_U16;
+                case '4': return EM_OP_LITERAL_U32;
+                case '8': return EM_OP_LITERAL_U64;
+                case 'f': return EM_OP_LITERAL_F32;
+                case 'd': return EM_OP_LITERAL_F64;
+                case 's': return EM_OP_LITERAL_STRING;
+                case 'n': return EM_OP_LITERAL_NULL;
+                case '*': return EM_OP_NOP;
+            }
+        break;
+
+        case EM_BOOLEAN:
+            switch(code) {
+                case '+': return EM_OP_BOOLEAN_ADD;
+                case 'a': return EM_OP_BOOLEAN_AND;
+                case 'o': return EM_OP_BOOLEAN_OR;
+                case '!': return EM_OP_BOOLEAN_NOT;
+                case '<': return EM_OP_BOOLEAN_LESS;
+                case '>': return EM_OP_BOOLEAN_GREATER;
+
+                // Reserved: subtract, multiply, divide, mod, logical not, and
+                case '-':
+                case '*':
+                case '/':
+                case '%':
+                case '~':
+                case '&':
+                    return EM_OP_NOP;
+            }
+        break;
+
+        case EM_MEMORY:
+            switch(code) {
+                case 'x': return EM_OP_MEMORY_ALLOCATE;
+                case 'a': return EM_OP_MEMORY_ARRAY;
+                case 'l': return EM_OP_MEMORY_LENGTH;
+                case 'e': return EM_OP_MEMORY_ELEMENTS;
+                case 'c': return EM_OP_MEMORY_COPY;
+                case 's': return EM_OP_MEMORY_SET;
+                case 'g': return EM_OP_MEMORY_GET;
+                case '(': return EM_OP_MEMORY_REGION_OPEN;
+                case ')': return EM_OP_MEMORY_REGION_CLOSE;
+            }
+        break;
+
+        case EM_STACK:
+            switch(code) {
+                case 'p': return EM_OP_STACK_POP;
+                case 'd': return EM_OP_STACK_DUPLICATE;
+                case 'c': return EM_OP_STACK_COPY;
+                case 'q': return EM_OP_STACK_POP_BENEATH;
+            }
+        break;
+
+        case EM_CC:
+            switch(code) {
+                case 'c': return EM_OP_C_CALL;
+            }
+        break;
+
+        case EM_DEBUG:
+            switch(code) {
+                case 's': return EM_OP_DEBUG_STACK;
+                case 't': return EM_OP_DEBUG_TRACE;
+                case 'u': return EM_OP_DEBUG_TYPES;
+                case 'r': return EM_OP_DEBUG_MEMORY;
+                case 'i': return EM_OP_DEBUG_INSPECT;
+                case 'f': return EM_OP_DEBUG_FUSIONS;
+                case 'l': return EM_OP_DEBUG_ASSERT_LINE;
+                case 'a': return EM_OP_DEBUG_ASSERT;
+                case 'c': return EM_OP_DEBUG_COLLECT;
+            }
+        break;
+
+        case EM_UDT:
+            switch(code) {
+                case 'c': return EM_OP_UDT_CREATE;
+                case 'g': return EM_OP_UDT_GET;
+                case 's': return EM_OP_UDT_SET;
+                case 'd': return EM_OP_UDT_DEFINE;
+            }
+        break;
+
+        case EM_CONTROL_FLOW:
+        break;
+    }
+
+    return EM_OP_UNKNOWN;
+}
+
+static void decode_instruction(em_state* state, em_instruction* inst, int index, ESOMODE mode, uint8_t control_flow_token) {
+
+    memset(inst, 0, sizeof(em_instruction));
+
+    inst->code = state->code[index];
+    inst->index = index;
+    inst->next = index + 1;
+    inst->mode = mode;
+    inst->control_flow_token = control_flow_token;
+
+    // 'Free letters' i.e. top level mode changes
+    if (tolower(inst->code) == 'm') {
+        inst->next = index + 2;
+
+        if (index + 1 >= state->len) {
+            inst->opcode = EM_OP_MODE; // Panics when run: no mode to change to
+        } else {
+            inst->opcode = decode_mode_change(state->code[index + 1], &inst->operand.mode);
+        }
+
+        return;
+    }
+
+    inst->opcode = decode_opcode(inst->code, mode, control_flow_token);
+
+    // Only control flow is case sensitive
+    if (mode != EM_CONTROL_FLOW) {
+        inst->code = tolower(inst->code);
+    }
+
+    // Work out how much of the source the instruction eats and pre-parse
+    // any operand so it isn't re-read every time the instruction runs
+    switch(inst->opcode) {
+        case EM_OP_LITERAL_BOOL:
+        case EM_OP_CONTROL_SET_TOKEN:
+            inst->next = index + 2;
+        break;
+
+        case EM_OP_CONTROL_REWIND:
+        case EM_OP_CONTROL_FAST_FORWARD:
+            inst->operand.target = EM_TARGET_UNRESOLVED;
+        break;
+
+        case EM_OP_C_CALL:
+            inst->operand.binding = -1;
+        break;
+
+        case EM_OP_LITERAL_U8:
+        case EM_OP_LITERAL_U16:
+        case EM_OP_LITERAL_U32:
+        case EM_OP_LITERAL_U64:
+        case EM_OP_LITERAL_F32:
+        case EM_OP_LITERAL_F64:
+        case EM_OP_LITERAL_STRING:
+        case EM_OP_DEBUG_ASSERT_LINE:
+        case EM_OP_UDT_CREATE:
+        case EM_OP_UDT_GET:
+        case EM_OP_UDT_SET:
+        {
+            int start = index + 1;
+
+            // Operands are the text after any leading whitespace up until the ;
+            while (start < state->len && isspace(state->code[start])) {
+                start++;
+            }
+
+            int terminator = find_until(state->code, start, state->len, ';', false);
+
+            if (terminator == -1) {
+                inst->unterminated = true;
+                inst->next = state->len;
+                break;
+            }
+
+            inst->next = terminator + 1;
+            inst->operand.text.start = start;
+            inst->operand.text.length = strnlen(state->code + start, terminator - start); // Stop at any embedded NUL
+
+            // Parsed values replace the text span
+            switch(inst->opcode) {
+                case EM_OP_LITERAL_U8:
+                case EM_OP_LITERAL_U16:
+                case EM_OP_LITERAL_U32:
+                case EM_OP_LITERAL_U64:
+                case EM_OP_LITERAL_F32:
+                case EM_OP_LITERAL_F64:
+                    decode_literal(state, inst, start, terminator);
+                break;
+
+                case EM_OP_DEBUG_ASSERT_LINE:
+                    inst->operand.line = atoi(state->code + start);
+                break;
+            }
+        }
+        break;
+    }
+}
+
+static int32_t new_instruction_slot(em_state* state) {
+
+    if ((state->instruction_ptr + 1) >= state->max_instructions) {
+
+        int new_max = state->max_instructions * 2;
+        em_instruction* grown = em_bytecode_alloc(state, sizeof(em_instruction) * new_max);
+        memcpy(grown, state->instructions, sizeof(em_instruction) * state->max_instructions);
+
+        em_bytecode_free(state, state->instructions, sizeof(em_instruction) * state->max_instructions);
+        state->instructions = grown;
+        state->max_instructions = new_max;
+    }
+
+    state->instruction_ptr++;
+    return state->instruction_ptr;
+}
+
+// Decode whatever executes from index onwards in the given mode, replacing anything
+// previously decoded there
+em_instruction* em_decode(em_state* state, int index, ESOMODE mode, uint8_t control_flow_token) {
+
+    int start = skip_insignificant(state, index);
+
+    if (start >= state->len) {
+        state->instruction_at[index] = EM_INSTRUCTION_AT_END;
+        return NULL;
+    }
+
+    int32_t slot = state->instruction_at[start];
+
+    if (slot < 0) {
+        slot = new_instruction_slot(state);
+    }
+
+    em_instruction* inst = &state->instructions[slot];
+    decode_instruction(state, inst, start, mode, control_flow_token);
+    state->decode_generation++;
+
+    state->instruction_at[start] = slot;
+    state->instruction_at[index] = slot;
+
+    log_verbose("Decoded %c @ %d as opcode %d (resume at %d)\n", inst->code, inst->index, inst->opcode, inst->next);
+
+    return inst;
+}
+
+em_instruction* em_fetch(em_state* state, int index) {
+
+    int32_t slot = state->instruction_at[index];
+
+    if (slot == EM_INSTRUCTION_AT_END) {
+        return NULL;
+    }
+
+    if (slot >= 0) {
+        em_instruction* inst = &state->instructions[slot];
+
+        // Mode changes mean the same thing in any mode. Everything else
+        // only holds if we're in the mode it was decoded for
+        if (inst->opcode == EM_OP_MODE) {
+            return inst;
+        }
+
+        if (inst->mode == state->mode &&
+            (inst->mode != EM_CONTROL_FLOW || inst->control_flow_token == state->control_flow_token)) {
+            return inst;
+        }
+    }
+
+    // Never decoded or decoded for a different mode: we got here by jumping
+    return em_decode(state, index, state->mode, state->control_flow_token);
+}
+
+void em_release_bytecode(em_state* state) {
+
+    if (state->instructions != NULL) {
+        em_bytecode_free(state, state->instructions, sizeof(em_instruction) * state->max_instructions);
+        state->instructions = NULL;
+    }
+
+    if (state->instruction_at != NULL) {
+        em_bytecode_free(state, state->instruction_at, sizeof(int32_t) * state->instruction_at_size);
+        state->instruction_at = NULL;
+    }
+
+    state->instruction_ptr = -1;
+    state->max_instructions = 0;
+    state->instruction_at_size = 0;
+
+    release_markers(state);
+    release_newlines(state);
+    em_jit_release(state);
+}
+
+// Decode the straight-line reading of the code up front. Anything reached by a jump into
+// a different mode is decoded on demand by em_fetch
+void em_compile(em_state* state) {
+
+    em_release_bytecode(state);
+
+    state->instruction_at_size = state->len + 1;
+    state->instruction_at = em_bytecode_alloc(state, sizeof(int32_t) * state->instruction_at_size);
+    memset(state->instruction_at, 0xFF, sizeof(int32_t) * state->instruction_at_size); // All -1
+
+    state->max_instructions = 64;
+    state->instructions = em_bytecode_alloc(state, sizeof(em_instruction) * state->max_instructions);
+
+    ESOMODE mode = state->mode;
+    int index = 0;
+
+    while (index < state->len) {
+
+        em_instruction* inst = em_decode(state, index, mode, state->control_flow_token);
+
+        if (inst == NULL) {
+            break;
+        }
+
+        if (inst->opcode == EM_OP_MODE && inst->index + 1 < state->len) {
+            mode = inst->operand.mode;
+        }
+
+        index = inst->next;
+    }
+
+#ifndef ESO_NO_FUSION
+    em_fuse(state);
+#endif
+
+    log_verbose("Compiled %db of code to %d instructions\n", state->len, state->instruction_ptr + 1);
+}
+
+// Move on to whatever instruction executes from index. Leaves the execution loop
+// when we run out of code or a handler asked us to stop
+#ifdef ESO_VERBOSE_DEBUG
+    #define EM_TRACE_POSITION() log_verbose("---------------------------- %d:%d\n", calculate_file_line(state), calculate_file_column(state))
+#else
+    #define EM_TRACE_POSITION()
+#endif
+
+#ifdef ESO_JIT
+    #define EM_JIT_STEP() \
+        if (state->jit_enabled) { \
+            EM_SPILL(); \
+            if ((inst = em_jit_step(state, inst, index)) == NULL) { \
+                return; \
+            } \
+        }
+#else
+    #define EM_JIT_STEP()
+#endif
+
+// Top of stack caching: the hottest stack instructions work on a copy of the top item
+// held in a local (so in registers) instead of going through state->stack. stack_ptr
+// always counts it, but its slot in state->stack is only up to date once spilled, which
+// happens before anything else that looks at the stack runs (or the loop is left).
+// Verbose builds leave it out so every instruction is logged by its handler.
+// Build with -DESO_NO_TOS_CACHE to always go through state->stack
+#if !defined(ESO_NO_TOS_CACHE) && !defined(ESO_VERBOSE_DEBUG)
+    #define ESO_TOS_CACHE
+#endif
+
+#ifdef ESO_TOS_CACHE
+
+// run_cached is only ever called with a constant opcode, so inlining it leaves just the
+// code for that opcode behind
+#if defined(__GNUC__) || defined(__clang__)
+    #define EM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+    #define EM_ALWAYS_INLINE inline
+#endif
+
+typedef struct {
+    em_stack_item item;
+    bool cached;
+} em_tos;
+
+static inline void tos_spill(em_state* state, em_tos* tos) {
+    if (tos->cached) {
+        state->stack[state->stack_ptr] = tos->item;
+        tos->cached = false;
+    }
+}
+
+// Make sure the top is in the cache. false if the stack is empty
+static inline bool tos_load(em_state* state, em_tos* tos) {
+
+    if (!tos->cached) {
+        if (state->stack_ptr < 0) {
+            return false;
+        }
+
+        tos->item = state->stack[state->stack_ptr];
+        tos->cached = true;
+    }
+
+    return true;
+}
+
+// Instructions that never look at the stack can run without spilling
+static inline bool uses_stack(uint16_t opcode) {
+    return opcode != EM_OP_MODE && opcode != EM_OP_NOP && opcode != EM_OP_CONTROL_MARKER && opcode != EM_OP_CONTROL_IF;
+}
+
+#define EM_TOS_TYPED_BINARY(opcode, type_code, field, result_code, result_field, operator) \
+    case opcode: { \
+        if (!tos_load(state, tos) || state->stack_ptr < 1 || \
+            tos->item.code != type_code || state->stack[state->stack_ptr - 1].code != type_code) { \
+            return false; \
+        } \
+        em_stack_item result; \
+        memset(&result, 0, sizeof(em_stack_item)); \
+        result.code = result_code; \
+        result.u.result_field = state->stack[state->stack_ptr - 1].u.field operator tos->item.u.field; \
+        tos->item = result; \
+        state->stack_ptr--; \
+        *index = inst->next; \
+        return true; \
+    }
+
+// Run inst against the cached top if it's one of the instructions that can, setting
+// where to go next. false to run its handler as normal (which leaves any panic to it)
+static EM_ALWAYS_INLINE bool run_cached(em_state* state, em_instruction* inst, uint16_t opcode, em_tos* tos, int* index) {
+
+    switch(opcode) {
+        case EM_OP_LITERAL_U8:
+        case EM_OP_LITERAL_U16:
+        case EM_OP_LITERAL_U32:
+        case EM_OP_LITERAL_U64:
+        case EM_OP_LITERAL_F32:
+        case EM_OP_LITERAL_F64:
+            if (inst->unterminated || (state->stack_ptr + 1) >= state->stack_size) {
+                return false;
+            }
+
+            tos_spill(state, tos);
+            tos->item = inst->operand.literal;
+            tos->cached = true;
+            state->stack_ptr++;
+
+            *index = inst->next;
+            return true;
+
+        case EM_OP_STACK_DUPLICATE:
+            if (!tos_load(state, tos) || is_code_using_managed_memory(tos->item.code) ||
+                (state->stack_ptr + 1) >= state->stack_size) {
+                return false;
+            }
+
+            // The copy underneath is the one that needs writing out
+            state->stack[state->stack_ptr] = tos->item;
+            state->stack_ptr++;
+
+            *index = inst->next;
+            return true;
+
+        case EM_OP_STACK_POP:
+            if (!tos_load(state, tos) || is_code_using_managed_memory(tos->item.code)) {
+                return false;
+            }
+
+            tos->cached = false;
+            state->stack_ptr--;
+
+            *index = inst->next;
+            return true;
+
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_ADD_U8, '1', v_byte, '1', v_byte, +)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_ADD_U16, '2', v_int16, '2', v_int16, +)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_ADD_U32, '4', v_int32, '4', v_int32, +)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_ADD_U64, '8', v_int64, '8', v_int64, +)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_ADD_F32, 'f', v_float, 'f', v_float, +)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_ADD_F64, 'd', v_double, 'd', v_double, +)
+
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_LESS_U8, '1', v_byte, '?', v_bool, <)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_LESS_U16, '2', v_int16, '?', v_bool, <)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_LESS_U32, '4', v_int32, '?', v_bool, <)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_LESS_U64, '8', v_int64, '?', v_bool, <)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_LESS_F32, 'f', v_float, '?', v_bool, <)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_LESS_F64, 'd', v_double, '?', v_bool, <)
+
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_GREATER_U8, '1', v_byte, '?', v_bool, >)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_GREATER_U16, '2', v_int16, '?', v_bool, >)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_GREATER_U32, '4', v_int32, '?', v_bool, >)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_GREATER_U64, '8', v_int64, '?', v_bool, >)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_GREATER_F32, 'f', v_float, '?', v_bool, >)
+        EM_TOS_TYPED_BINARY(EM_OP_BOOLEAN_GREATER_F64, 'd', v_double, '?', v_bool, >)
+
+        // ml <n>; mb + (see run_fused_add_immediate)
+        case EM_OP_FUSED_ADD_IMMEDIATE: {
+            em_stack_item* literal = &inst->operand.literal;
+
+            if (!tos_load(state, tos) || tos->item.code != literal->code || (state->stack_ptr + 1) >= state->stack_size) {
+                return false;
+            }
+
+            em_stack_item result;
+            memset(&result, 0, sizeof(em_stack_item));
+            result.code = literal->code;
+
+            switch(literal->code) {
+                case '1': result.u.v_byte = tos->item.u.v_byte + literal->u.v_byte; break;
+                case '2': result.u.v_int16 = tos->item.u.v_int16 + literal->u.v_int16; break;
+                case '4': result.u.v_int32 = tos->item.u.v_int32 + literal->u.v_int32; break;
+                case '8': result.u.v_int64 = tos->item.u.v_int64 + literal->u.v_int64; break;
+                case 'f': result.u.v_float = tos->item.u.v_float + literal->u.v_float; break;
+                case 'd': result.u.v_double = tos->item.u.v_double + literal->u.v_double; break;
+            }
+
+            tos->item = result;
+
+            *index = em_end_fused(state, inst, EM_FUSION_ADD_IMMEDIATE, EM_BOOLEAN);
+            return true;
+        }
+
+        // mb < or > then mf < or > (see run_fused_compare_branch)
+        case EM_OP_FUSED_COMPARE_BRANCH: {
+            if (!tos_load(state, tos) || state->stack_ptr < 1 || inst->control_flow_token != state->control_flow_token) {
+                return false;
+            }
+
+            em_stack_item* one = &state->stack[state->stack_ptr - 1];
+            em_stack_item* two = &tos->item;
+
+            if (one->code != two->code) {
+                return false;
+            }
+
+            bool less = (inst->fused.opcode == EM_OP_BOOLEAN_LESS);
+            bool result = false;
+
+            switch(one->code) {
+                case '1': result = less ? one->u.v_byte < two->u.v_byte : one->u.v_byte > two->u.v_byte; break;
+                case '2': result = less ? one->u.v_int16 < two->u.v_int16 : one->u.v_int16 > two->u.v_int16; break;
+                case '4': result = less ? one->u.v_int32 < two->u.v_int32 : one->u.v_int32 > two->u.v_int32; break;
+                case '8': result = less ? one->u.v_int64 < two->u.v_int64 : one->u.v_int64 > two->u.v_int64; break;
+                case 'f': result = less ? one->u.v_float < two->u.v_float : one->u.v_float > two->u.v_float; break;
+                case 'd': result = less ? one->u.v_double < two->u.v_double : one->u.v_double > two->u.v_double; break;
+
+                default:
+                    return false;
+            }
+
+            // Numbers: nothing to release
+            state->stack_ptr -= 2;
+            tos->cached = false;
+
+            if (inst->fused.toggles_if) {
+                state->control_flow_if_flag = !state->control_flow_if_flag;
+            }
+
+            int next = em_end_fused(state, inst, EM_FUSION_COMPARE_BRANCH, EM_CONTROL_FLOW);
+
+            if (state->control_flow_if_flag) {
+
+                if (!result) {
+                    *index = next;
+                    return true;
+                }
+
+            } else {
+
+                // Unconditional jump: the result stays on the stack
+                memset(&tos->item, 0, sizeof(em_stack_item));
+                tos->item.u.v_bool = result;
+                tos->item.code = '?';
+                tos->cached = true;
+                state->stack_ptr++;
+            }
+
+            if (inst->fused.target == EM_TARGET_UNRESOLVED) {
+                inst->fused.target = find_marker(state, inst->fused.branch, inst->fused.backwards);
+            }
+
+            *index = inst->fused.target == -1 ? next : inst->fused.target + 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#define EM_SPILL() tos_spill(state, &tos)
+
+#define EM_RUN(name, handler) \
+    if (!run_cached(state, inst, name, &tos, &index)) { \
+        if (uses_stack(name)) { \
+            EM_SPILL(); \
+        } \
+        index = handler(state, inst); \
+    }
+
+#else
+    #define EM_SPILL()
+    #define EM_RUN(name, handler) index = handler(state, inst);
+#endif
+
+#define EM_FETCH() \
+    if (index < 0 || index >= state->len || (inst = em_fetch(state, index)) == NULL) { \
+        EM_SPILL(); \
+        return; \
+    } \
+    EM_JIT_STEP(); \
+    state->index = inst->index; \
+    EM_TRACE_POSITION();
+
+#ifdef ESO_THREADED_DISPATCH
+
+// Each handler jumps straight to the next one: one indirect branch per instruction
+// (and a separate one per opcode, which predicts far better than a shared switch)
+void em_execute(em_state* state, int index) {
+
+    static void* dispatch[EM_OP_COUNT] = {
+        #define X(name, handler) [name] = &&label_##name,
+        EM_OPCODES(X)
+        #undef X
+    };
+
+    em_instruction* inst = NULL;
+
+#ifdef ESO_TOS_CACHE
+    em_tos tos = { .cached = false };
+#endif
+
+    EM_FETCH();
+    goto *dispatch[inst->opcode];
+
+    #define X(name, handler) \
+        label_##name: \
+            EM_RUN(name, handler); \
+            EM_FETCH(); \
+            goto *dispatch[inst->opcode];
+    EM_OPCODES(X)
+    #undef X
+}
+
+#else
+
+void em_execute(em_state* state, int index) {
+
+    em_instruction* inst = NULL;
+
+#ifdef ESO_TOS_CACHE
+    em_tos tos = { .cached = false };
+#endif
+
+    while (true) {
+
+        EM_FETCH();
+
+        switch(inst->opcode) {
+            #define X(name, handler) case name: EM_RUN(name, handler); break;
+            EM_OPCODES(X)
+            #undef X
+
+            default:
+                EM_SPILL();
+                em_panic(state, "Corrupt instruction stream: opcode %d", inst->opcode);
+            break;
+        }
+    }
+}
+
+#endif
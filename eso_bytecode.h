@@ -0,0 +1,32 @@
+#pragma once
+#include "eso_vm.h"
+
+// Threaded dispatch (labels as values) is used wherever the compiler supports it.
+// Build with -DESO_SWITCH_DISPATCH to use the portable switch loop instead
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(ESO_SWITCH_DISPATCH)
+    #define ESO_THREADED_DISPATCH
+#endif
+
+// Every handler returns the source index execution resumes from, or -1 to stop
+typedef int (*em_op)(em_state* state, em_instruction* inst);
+
+extern em_op em_op_handlers[EM_OP_COUNT];
+
+// Name of each handler, for code generated by em_emit_c
+extern const char* em_op_handler_names[EM_OP_COUNT];
+
+void em_compile(em_state* state);
+
+void em_release_bytecode(em_state* state);
+
+em_instruction* em_decode(em_state* state, int index, ESOMODE mode, uint8_t control_flow_token);
+
+em_instruction* em_fetch(em_state* state, int index);
+
+void em_execute(em_state* state, int index);
+
+int run_mode_change(em_state* state, em_instruction* inst);
+
+int run_nop(em_state* state, em_instruction* inst);
+
+int run_unknown(em_state* state, em_instruction* inst);
\ No newline at end of file
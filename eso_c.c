@@ -7,60 +7,45 @@
 #include <string.h>
 #include <stdio.h>
 
-int run_c(em_state* state) {
+// Call a global function name
+int run_c_call(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (C interop)\n", inst->code);
+    log_ingestion(inst->code);
 
-    char current_code = tolower(state->code[state->index]);
-    log_verbose("\033[0;31m%c\033[0;0m (C interop)\n", current_code);
-    log_ingestion(current_code);
+    em_stack_item* str = stack_top(state);
 
-    int size_to_skip  = 0;
-    
-    switch(current_code) {
+    if (str == NULL || str->code != 's') {
+        em_panic(state, "Expected an s at stack top to call C function (name)");
+    }  
 
-        // Call a global function name
-        case 'c':
-        {
-            em_stack_item* str = stack_top(state);
-
-            if (str == NULL || str->code != 's') {
-                em_panic(state, "Expected an s at stack top to call C function (name)");
-            }  
-
-            if (str->u.v_mptr == state->null) {
-                em_panic(state, "Attempting to call C method using NULL as method name");
-            }
-
-            em_c_binding* binding = NULL;
-
-            // Find call by name
-            for(int i = 0; i <= state->c_binding_ptr; i++) {
-                if (strcmp(str->u.v_mptr->raw, state->c_bindings[i].name) == 0) {
-                    binding = &state->c_bindings[i];
-                    break;
-                }
-            }
+    if (str->u.v_mptr == state->null) {
+        em_panic(state, "Attempting to call C method using NULL as method name");
+    }
 
-            // No such binding
-            if (binding == NULL) {
-                em_panic(state, "No such C function bound '%s'", str->u.v_mptr->raw);
-            }
+    const char* name = (char*)str->u.v_mptr->raw;
+    em_c_binding* binding = NULL;
 
-            stack_pop(state);
+    // Call sites nearly always call the same function: check the last one before searching
+    if (inst->operand.binding != -1 && strcmp(state->c_bindings[inst->operand.binding].name, name) == 0) {
+        binding = &state->c_bindings[inst->operand.binding];
+    } else {
+        binding = em_find_c_binding(state, name);
 
-            log_verbose("CALL INTO C FUNCTION %s @ %p\n", binding->name, binding->bound);
+        // No such binding
+        if (binding == NULL) {
+            em_panic(state, "No such C function bound '%s'", name);
+        }
 
-            binding->bound(state);
+        inst->operand.binding = binding - state->c_bindings;
+    }
 
-            log_verbose("FINISHED CALL INTO C FUNCTION %s @ %p\n", binding->name, binding->bound);
+    stack_pop(state);
 
-        }
-        return size_to_skip;
+    log_verbose("CALL INTO C FUNCTION %s @ %p\n", binding->name, binding->bound);
 
-        default:
-            em_panic(state, "Unknown C interop instruction %c", current_code);
-            return size_to_skip;
+    binding->bound(state);
 
-    }
+    log_verbose("FINISHED CALL INTO C FUNCTION %s @ %p\n", binding->name, binding->bound);
 
-    return size_to_skip;
+    return inst->next;
 }
\ No newline at end of file
@@ -1,3 +1,3 @@
 #pragma once
 
-int run_c(em_state* state);
+int run_c_call(em_state* state, em_instruction* inst);
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "eso_vm.h"
+#include "eso_log.h"
+#include "eso_collect.h"
+
+// Synchronous cycle collection by trial deletion.
+//
+// Every live object is in one of the header slabs (or on state->mptr_list without them)
+// or an open region's chunks, so the collector can see them all.
+// Taking away the references live objects hold to each other leaves only the references
+// from outside managed memory: the stack, and anything else holding on to an object.
+// Objects still referenced from outside, and everything they lead to, are reachable. The
+// rest are only referenced by each other and are freed together.
+//
+// Anything with no counted references has been freed, unless deferred counting says it
+// might be on the stack (em_free_unreferenced has just been through those)
+static bool is_live(em_managed_ptr* mptr) {
+    return mptr->references > 0 || mptr->deferred;
+}
+
+// Call visit for every object still referenced
+static void for_each_object(em_state* state, em_visit visit) {
+
+#ifdef ESO_NO_SLAB
+    for (em_managed_ptr* mptr = state->mptr_list; mptr != NULL; mptr = mptr->next) {
+
+        if (is_live(mptr)) {
+            visit(state, mptr);
+        }
+    }
+#else
+    for (em_mptr_slab* slab = state->mptr_slabs; slab != NULL; slab = slab->next) {
+        char* blocks = (char*)(slab + 1);
+
+        for (uint32_t i = 0; i < slab->block_count; i++) {
+            em_managed_ptr* mptr = (em_managed_ptr*)(blocks + (i * slab->block_size));
+
+            if (is_live(mptr)) {
+                visit(state, mptr);
+            }
+        }
+    }
+#endif
+
+    for (int i = 0; i < state->region_depth; i++) {
+
+        for (em_arena_chunk* chunk = state->regions[i].arena; chunk != NULL; chunk = chunk->next) {
+            char* blocks = (char*)(chunk + 1);
+
+            for (size_t offset = 0; offset < chunk->used; ) {
+                em_managed_ptr* mptr = (em_managed_ptr*)(blocks + offset);
+                offset += em_region_block_size(mptr->size);
+
+                if (is_live(mptr)) {
+                    visit(state, mptr);
+                }
+            }
+        }
+    }
+}
+
+static void push_work(em_state* state, em_managed_ptr* mptr) {
+
+    if (state->collect_work_count == state->max_collect_work) {
+        int max_collect_work = state->max_collect_work == 0 ? 64 : state->max_collect_work * 2;
+        em_managed_ptr** collect_work = em_perma_alloc(state, sizeof(em_managed_ptr*) * max_collect_work);
+
+        if (state->collect_work != NULL) {
+            memcpy(collect_work, state->collect_work, sizeof(em_managed_ptr*) * state->collect_work_count);
+            em_perma_free(state, state->collect_work, sizeof(em_managed_ptr*) * state->max_collect_work);
+        }
+
+        state->collect_work = collect_work;
+        state->max_collect_work = max_collect_work;
+    }
+
+    state->collect_work[state->collect_work_count++] = mptr;
+}
+
+static void begin_trial(em_state* state, em_managed_ptr* mptr) {
+    mptr->gc_references = mptr->references;
+    mptr->gc_reachable = false;
+}
+
+static void subtract_internal(em_state* state, em_managed_ptr* mptr) {
+    mptr->gc_references--;
+}
+
+static void subtract_internal_references(em_state* state, em_managed_ptr* mptr) {
+    em_visit_references(state, mptr, subtract_internal);
+}
+
+static void mark(em_state* state, em_managed_ptr* mptr) {
+
+    if (!mptr->gc_reachable) {
+        mptr->gc_reachable = true;
+        push_work(state, mptr);
+    }
+}
+
+static void mark_if_external(em_state* state, em_managed_ptr* mptr) {
+
+    if (mptr->gc_references > 0) {
+        mark(state, mptr);
+    }
+}
+
+// Garbage only gives up its references to reachable objects: garbage it refers to is
+// going anyway
+static void drop_reachable(em_state* state, em_managed_ptr* mptr) {
+
+    if (mptr->gc_reachable) {
+        mptr->references--;
+    }
+}
+
+static void drop_garbage_references(em_state* state, em_managed_ptr* mptr) {
+
+    if (!mptr->gc_reachable) {
+        em_visit_references(state, mptr, drop_reachable);
+        push_work(state, mptr);
+    }
+}
+
+int em_collect_cycles(em_state* state) {
+
+    // Tracing finds cycles like any other garbage
+    if (state->tracing) {
+        return em_trace_heap(state);
+    }
+
+    // Nothing waiting to be freed should be found in the slabs
+    em_free_unreferenced(state);
+
+    uint32_t allocated = state->memory_usercode.allocated;
+
+    for_each_object(state, begin_trial);
+    for_each_object(state, subtract_internal_references);
+
+    state->collect_work_count = 0;
+    for_each_object(state, mark_if_external);
+
+    // The stack might not be counted (ESO_DEFERRED_RC)
+    for (int i = 0; i <= state->stack_ptr; i++) {
+        em_stack_item* item = &state->stack[i];
+
+        if (is_code_using_managed_memory(item->code) && item->u.v_mptr != state->null) {
+            mark(state, item->u.v_mptr);
+        }
+    }
+
+    while (state->collect_work_count > 0) {
+        em_visit_references(state, state->collect_work[--state->collect_work_count], mark);
+    }
+
+    // Gather the garbage before freeing any so each one's references are still there to
+    // follow
+    for_each_object(state, drop_garbage_references);
+
+    int freed = state->collect_work_count;
+
+    for (int i = 0; i < freed; i++) {
+        release_managed_ptr(state, state->collect_work[i]);
+    }
+
+    state->collect_work_count = 0;
+
+    log_verbose("Collected %d objects in cycles (%db)\n", freed, allocated - state->memory_usercode.allocated);
+    return freed;
+}
+
+// Tracing mode.
+//
+// References aren't counted at all: every object in use just has one, so it can be told
+// apart from a free block. A trace marks everything reachable from the stack through UDT
+// fields and managed array elements, then frees the rest back into their slabs
+
+static void unmark(em_state* state, em_managed_ptr* mptr) {
+    mptr->gc_reachable = false;
+}
+
+static void gather_unmarked(em_state* state, em_managed_ptr* mptr) {
+
+    if (!mptr->gc_reachable) {
+        push_work(state, mptr);
+    }
+}
+
+int em_trace_heap(em_state* state) {
+
+    uint32_t allocated = state->memory_usercode.allocated;
+
+    for_each_object(state, unmark);
+
+    state->collect_work_count = 0;
+
+    for (int i = 0; i <= state->stack_ptr; i++) {
+        em_stack_item* item = &state->stack[i];
+
+        if (is_code_using_managed_memory(item->code) && item->u.v_mptr != state->null) {
+            mark(state, item->u.v_mptr);
+        }
+    }
+
+    while (state->collect_work_count > 0) {
+        em_visit_references(state, state->collect_work[--state->collect_work_count], mark);
+    }
+
+    for_each_object(state, gather_unmarked);
+
+    int freed = state->collect_work_count;
+
+    for (int i = 0; i < freed; i++) {
+        em_managed_ptr* mptr = state->collect_work[i];
+
+        if (mptr->size == 0) {
+            em_panic(state, "Attempting to free allocation of zero size: Unlikely to be legitimate allocation");
+        }
+
+        release_managed_ptr(state, mptr);
+    }
+
+    state->collect_work_count = 0;
+
+    state->trace_next = (state->memory_usercode.allocated + state->memory_usercode.overhead) * 2;
+
+    if (state->trace_next < EM_TRACE_MINIMUM) {
+        state->trace_next = EM_TRACE_MINIMUM;
+    }
+
+    log_verbose("Traced: freed %d objects (%db)\n", freed, allocated - state->memory_usercode.allocated);
+    return freed;
+}
+
+int run_debug_collect(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
+
+    em_collect_cycles(state);
+    return inst->next;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "eso_vm.h"
+
+// Free every object only kept alive by a cycle of references (the rest of managed memory
+// is freed by reference counting alone). Returns how many objects were freed.
+// Runs on md c, the memory.collect C binding, or once usercode allocations pass
+// state->collect_threshold (eb: --collect-threshold=n)
+int em_collect_cycles(em_state* state);
+
+// Usercode bytes (allocations and overhead) a state in tracing mode can reach before its
+// first trace. After that it traces again at twice whatever was left by the last one
+#define EM_TRACE_MINIMUM 65536
+
+// Free every object not reachable from the stack, for states that trace instead of
+// counting references (eb: --tracing). Returns how many objects were freed
+int em_trace_heap(em_state* state);
+
+int run_debug_collect(em_state* state, em_instruction* inst);
\ No newline at end of file
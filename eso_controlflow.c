@@ -12,384 +12,524 @@
 #include <stdarg.h> 
 #include <stdbool.h>
 
-int run_control(em_state* state) {
+// Control flow handlers return the index execution resumes from (or -1 to stop)
+// rather than always continuing after the instruction
 
-    char current_code = state->code[state->index];
-    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", current_code);
-    log_ingestion(current_code);
+void release_markers(em_state* state) {
 
-    // The * marker has no meaning on its own so skip it
-    if (current_code == state->control_flow_token) {
-        return state->index;
+    if (state->markers != NULL) {
+        em_bytecode_free(state, state->markers, sizeof(int32_t) * state->marker_count);
+        state->markers = NULL;
     }
 
-    switch(current_code) {
+    state->marker_count = 0;
+    state->markers_token = -1;
+}
 
-        // Exit
-        case 'x': 
-        {
-            return -1;
+// Record where every control flow symbol is so rewind/fast-forward don't
+// have to scan the code. Rebuilt if mf s has changed the symbol since
+static void index_markers(em_state* state) {
+
+    if (state->markers_token == state->control_flow_token) {
+        return;
+    }
+
+    release_markers(state);
+
+    for (int i = 0; i < state->len; i++) {
+        if (state->code[i] == state->control_flow_token) {
+            state->marker_count++;
         }
+    }
 
-        // Create a label at the current location
-        case 'l':
-        {
-            em_stack_item* name = stack_top(state);
+    state->markers = em_bytecode_alloc(state, sizeof(int32_t) * state->marker_count);
+    state->markers_token = state->control_flow_token;
 
-            if (name == NULL || name->code != 's') {
-                em_panic(state, "Creating label requires a string name at stack top");
-            }
+    int marker = 0;
 
-            if (name->u.v_mptr == state->null) {
-                em_panic(state, "String name for creating label is NULL and cannot be used");
-            }
+    for (int i = 0; i < state->len; i++) {
+        if (state->code[i] == state->control_flow_token) {
+            state->markers[marker++] = i;
+        }
+    }
 
-            state->label_ptr++;
+    log_verbose("Indexed %d control flow symbols '%c'\n", state->marker_count, state->control_flow_token);
+}
 
-            if ((state->label_ptr + 1) >= state->max_labels) {
-                em_panic(state, "Label overflow (%d maximum of %d)", state->label_ptr, state->max_labels);
-            }
+// Nearest control flow symbol at or before (backwards) or at or after (forwards)
+// index. -1 if there is none
+int32_t find_marker(em_state* state, int index, bool backwards) {
 
-            char* label_name = (char*)name->u.v_mptr->raw;
-            em_label* label = &state->labels[state->label_ptr];
+    index_markers(state);
 
-            label->name = em_perma_alloc(state, strlen(label_name) + 1);
-            memset(label->name, 0, strlen(label_name) + 1);
-            memcpy(label->name, label_name, strlen(label_name));
+    // First marker > index
+    int low = 0;
+    int high = state->marker_count;
 
-            label->location = state->index+1;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
 
-            log_verbose("Labelled location %d '%s'\n",  label->location, label->name);
+        if (state->markers[middle] <= index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
 
-            stack_pop(state);
+    if (backwards) {
+        return low > 0 ? state->markers[low - 1] : -1;
+    }
+
+    // First marker >= index
+    if (low > 0 && state->markers[low - 1] == index) {
+        return index;
+    }
+
+    return low < state->marker_count ? state->markers[low] : -1;
+}
+
+// The slot holding the length characters of name, or the empty slot it would go in
+static em_label* find_label_slot(em_label* labels, int max_labels, const char* name, int length, uint32_t hash) {
+    uint32_t mask = max_labels - 1;
+
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        em_label* label = &labels[i];
+
+        if (label->name == NULL) {
+            return label;
         }
-        break;
 
-         // Forward-declare a label at an explicit index
-        case 'f':
-        {
-            em_stack_item* name = stack_top(state);
+        if (label->hash == hash && strncmp(label->name, name, length) == 0 && label->name[length] == 0) {
+            return label;
+        }
+    }
+}
 
-            if (name == NULL || name->code != 's') {
-                em_panic(state, "Creating label requires a string name at stack top");
-            }
+// NULL if there's no label called name (which need not be NUL terminated)
+em_label* find_label(em_state* state, const char* name, int length, uint32_t hash) {
+    em_label* label = find_label_slot(state->labels, state->max_labels, name, length, hash);
 
-            if (name->u.v_mptr == state->null) {
-                em_panic(state, "String name for creating label is NULL and cannot be used");
-            }
+    return label->name == NULL ? NULL : label;
+}
 
-            em_stack_item* index = stack_top_minus(state, 1);
+static void grow_labels(em_state* state) {
+    int max_labels = state->max_labels * 2;
+    em_label* labels = em_perma_alloc(state, sizeof(em_label) * max_labels);
+    memset(labels, 0, sizeof(em_label) * max_labels);
 
-            if (index == NULL || index->code != '4') {
-                em_panic(state, "Absolute location for a forward declared label must be a valid integer at stack top - 1");
-            }
+    for (int i = 0; i < state->max_labels; i++) {
+        em_label* label = &state->labels[i];
 
-            state->label_ptr++;
+        if (label->name != NULL) {
+            *find_label_slot(labels, max_labels, label->name, strlen(label->name), label->hash) = *label;
+        }
+    }
 
-            if ((state->label_ptr + 1) >= state->max_labels) {
-                em_panic(state, "Label overflow (%d maximum of %d)", state->label_ptr, state->max_labels);
-            }
+    em_perma_free(state, state->labels, sizeof(em_label) * state->max_labels);
+    state->labels = labels;
+    state->max_labels = max_labels;
 
-            char* label_name = (char*)name->u.v_mptr->raw;
-            em_label* label = &state->labels[state->label_ptr];
+    log_verbose("Label table grown to %d\n", max_labels);
+}
 
-            label->name = em_perma_alloc(state, strlen(label_name) + 1);
-            memset(label->name, 0, strlen(label_name) + 1);
-            memcpy(label->name, label_name, strlen(label_name));
+// Defining a label that already exists just moves it
+static em_label* define_label(em_state* state, const char* name, uint32_t location) {
 
-            label->location = index->u.v_int32;
+    // Keep under 3/4 full so probes stay short
+    if ((state->label_count + 1) * 4 > state->max_labels * 3) {
+        grow_labels(state);
+    }
 
-            log_verbose("Labelled location %d '%s'\n",  label->location, label->name);
+    uint32_t hash = hash_name(name);
+    em_label* label = find_label_slot(state->labels, state->max_labels, name, strlen(name), hash);
 
-            stack_pop(state);
+    if (label->name == NULL) {
+        label->name = em_perma_alloc(state, strlen(name) + 1);
+        memcpy(label->name, name, strlen(name) + 1);
+        label->hash = hash;
+        state->label_count++;
+    }
 
-            stack_pop(state);
-        }
-        break;
+    label->location = location;
 
-        // Jump to location
-        case 'j':
-        {
-            em_stack_item* location = stack_top(state);
+    return label;
+}
 
-            if (location == NULL || location->code != '^') {                
-                em_panic(state, "Jump requires location (^) at stack top");
-            }
+// The control flow symbol has no meaning on its own so skip it
+int run_control_marker(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
 
-            if (location->u.v_int32 < 0 || location->u.v_int32 >= state->len) {
-                em_panic(state, "Location %d is invalid or out of bounds", location->u.v_int32);
-            }
+    return inst->next;
+}
 
-            state->index = location->u.v_int32 - 1;
+// Exit
+int run_control_exit(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
 
-        }
-        break;
+    return -1;
+}
 
-        // get a location by name
-        case 'g':
-        {
-            em_stack_item* name = stack_top(state);
+// Create a label at the current location
+int run_control_label(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
 
-            if (name == NULL || name->code != 's') {
-                em_panic(state, "Getting label location requires a string name at stack top");
-            }
+    em_stack_item* name = stack_top(state);
 
-            if (name->u.v_mptr == state->null) {
-                em_panic(state, "String name for getting label locationis NULL and cannot be used");
-            }
+    if (name == NULL || name->code != 's') {
+        em_panic(state, "Creating label requires a string name at stack top");
+    }
 
-            em_label* label = NULL;
+    if (name->u.v_mptr == state->null) {
+        em_panic(state, "String name for creating label is NULL and cannot be used");
+    }
 
-            // Find label by name
-            for(int i = 0; i <= state->label_ptr; i++) {
-                if (strcmp(name->u.v_mptr->raw, state->labels[i].name) == 0) {
-                    label = &state->labels[i];
-                    break;
-                }
-            }
+    em_label* label = define_label(state, (char*)name->u.v_mptr->raw, state->index+1);
 
-            // No such binding
-            if (label == NULL) {
-                em_panic(state, "No label name '%s'", name->u.v_mptr->raw);
-            }
+    log_verbose("Labelled location %d '%s'\n",  label->location, label->name);
 
-            stack_pop(state);
+    stack_pop(state);
 
-            int top = stack_push(state);
-            
-            state->stack[top].u.v_int32 = label->location;
-            state->stack[top].code = '^';
+    return inst->next;
+}
 
-        }   
-        break;
+// Forward-declare a label at an explicit index
+int run_control_forward_declare(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
 
-        case 'i':
-        {
-            // Toggle 'if' mode on/off
-            state->control_flow_if_flag = !state->control_flow_if_flag;
-        }
-        break;
+    em_stack_item* name = stack_top(state);
 
-        // Find the index relating to the line number at the top of the stack
-        case '$':
-        {
-            em_stack_item* location = stack_top(state);
+    if (name == NULL || name->code != 's') {
+        em_panic(state, "Creating label requires a string name at stack top");
+    }
 
-            if (location == NULL || location->code != '4') {
-                em_panic(state, "Determining location from line number requires a valid integer at stack top");
-            }
+    if (name->u.v_mptr == state->null) {
+        em_panic(state, "String name for creating label is NULL and cannot be used");
+    }
 
-            bool found_line_number = false;
-            uint32_t found_index = 0;
-            uint32_t line = 1;
+    em_stack_item* index = stack_top_minus(state, 1);
 
-            for(int i = 0; i < state->len; i++) {
-                if (state->code[i] == '\n') {
-                    line++;
+    if (index == NULL || index->code != '4') {
+        em_panic(state, "Absolute location for a forward declared label must be a valid integer at stack top - 1");
+    }
 
-                    if (line == location->u.v_int32) {
-                        found_index = i;
-                        found_line_number = true;
-                        break;
-                    }
-                }
-            }
+    em_label* label = define_label(state, (char*)name->u.v_mptr->raw, index->u.v_int32);
 
-            if (!found_line_number) {
-                 em_panic(state, "Did not find line %d while searching for index to create location: Max line reached was %d", location->u.v_int32, line);
-            }
+    log_verbose("Labelled location %d '%s'\n",  label->location, label->name);
 
-            stack_pop(state);
+    stack_pop(state);
 
-            int top = stack_push(state);
-            
-            state->stack[top].u.v_int32 = found_index;
-            state->stack[top].code = '4';
-        }
-        break;
+    stack_pop(state);
 
-        case 's': 
-        {
-            // Set the control flow symbol: Must be specified as an ASCII code
-            em_stack_item* top = stack_top(state);
+    return inst->next;
+}
 
-            if (top == NULL || top->code != '2') {
-                em_panic(state, "Setting control flow symbol requires a 1 on top of the stack (ASCII code for new symbol)");
-            }
+// Jump to location
+int run_control_jump(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
 
-            state->control_flow_token = top->u.v_byte;
+    em_stack_item* location = stack_top(state);
 
-            stack_pop(state);
+    if (location == NULL || location->code != '^') {
+        em_panic(state, "Jump requires location (^) at stack top");
+    }
+
+    if (location->u.v_int32 < 0 || location->u.v_int32 >= state->len) {
+        em_panic(state, "Location %d is invalid or out of bounds", location->u.v_int32);
+    }
+
+    return location->u.v_int32;
+}
+
+// Get a location by name
+int run_control_get_label(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
+
+    em_stack_item* name = stack_top(state);
+
+    if (name == NULL || name->code != 's') {
+        em_panic(state, "Getting label location requires a string name at stack top");
+    }
+
+    if (name->u.v_mptr == state->null) {
+        em_panic(state, "String name for getting label locationis NULL and cannot be used");
+    }
+
+    const char* label_name = (char*)name->u.v_mptr->raw;
+    em_label* label = find_label(state, label_name, strlen(label_name), hash_name(label_name));
+
+    // No such binding
+    if (label == NULL) {
+        em_panic(state, "No label name '%s'", name->u.v_mptr->raw);
+    }
+
+    stack_pop(state);
+
+    int top = stack_push(state);
+
+    state->stack[top].u.v_int32 = label->location;
+    state->stack[top].code = '^';
+
+    return inst->next;
+}
+
+// Toggle 'if' mode on/off
+int run_control_if(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
+
+    state->control_flow_if_flag = !state->control_flow_if_flag;
+
+    return inst->next;
+}
+
+// Find the index relating to the line number at the top of the stack
+int run_control_line(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
+
+    em_stack_item* location = stack_top(state);
+
+    if (location == NULL || location->code != '4') {
+        em_panic(state, "Determining location from line number requires a valid integer at stack top");
+    }
+
+    int32_t found_index = find_line_start(state, location->u.v_int32);
+
+    if (found_index == -1) {
+         em_panic(state, "Did not find line %d while searching for index to create location: Max line reached was %d", location->u.v_int32, count_file_lines(state));
+    }
+
+    stack_pop(state);
+
+    int top = stack_push(state);
+
+    state->stack[top].u.v_int32 = found_index;
+    state->stack[top].code = '4';
+
+    return inst->next;
+}
+
+// Set the control flow symbol
+int run_control_set_token(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
+
+    // Must be specified as an ASCII code
+    em_stack_item* top = stack_top(state);
+
+    if (top == NULL || top->code != '2') {
+        em_panic(state, "Setting control flow symbol requires a 1 on top of the stack (ASCII code for new symbol)");
+    }
+
+    state->control_flow_token = top->u.v_byte;
+
+    stack_pop(state);
+
+    return inst->next;
+}
+
+// Go backwards to the previous control flow symbol
+int run_control_rewind(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
+
+    if (state->control_flow_if_flag) {
+        // We only go backwards if a bool on top of the stack is true
+        em_stack_item* condition = stack_top(state);
+
+        if (condition == NULL) {
+            em_panic(state, "Operation rewind requires a ? on top the stack to check when if flag is set");
         }
-        return state->index+1;
-
-        case '<': 
-        {
-            if (state->control_flow_if_flag) {
-                // We only go backwards if a bool on top of the stack is true
-                em_stack_item* condition = stack_top(state);
-
-                if (condition == NULL) {
-                    em_panic(state, "Operation rewind requires a ? on top the stack to check when if flag is set");
-                } 
-
-                if (condition->code != '?') {
-                    em_panic(state, "Operation rewind requires a ? on top the stack (found %c) to check when if flag is set", condition->code);
-                }
-
-                if (!condition->u.v_bool) {
-                    stack_pop(state);
-                    break;
-                }
-
-                stack_pop(state);
-            }
-
-            // Go backwards
-            for (int i = state->index; i >= 0; i--) {
-
-                if (state->code[i] == state->control_flow_token) {
-                    log_ingestion(state->code[i]);
-                    log_verbose("Control flow backward jump to index %d\n", i);
-                    return i;
-                }
-            }
+
+        if (condition->code != '?') {
+            em_panic(state, "Operation rewind requires a ? on top the stack (found %c) to check when if flag is set", condition->code);
         }
-        break;
 
-        case '>':
-        {
-            if (state->control_flow_if_flag) {
-                em_stack_item* condition = stack_top(state);
+        if (!condition->u.v_bool) {
+            stack_pop(state);
+            return inst->next;
+        }
 
-                if (condition == NULL) {
-                    em_panic(state, "Operation fast-forward requires a ? on top the stack to check when if flag is set");
-                } 
+        stack_pop(state);
+    }
 
-                if (condition->code != '?') {
-                    em_panic(state, "Operation fast-forward requires a ? on top the stack (found %c) to check when if flag is set", condition->code);
-                }
+    // Go backwards (the destination can't change unless the instruction is decoded again)
+    if (inst->operand.target == EM_TARGET_UNRESOLVED) {
+        inst->operand.target = find_marker(state, state->index, true);
+    }
 
-                if (!condition->u.v_bool) {
-                    stack_pop(state);
-                    break;
-                }
+    if (inst->operand.target != -1) {
+        log_ingestion(state->code[inst->operand.target]);
+        log_verbose("Control flow backward jump to index %d\n", inst->operand.target);
+        return inst->operand.target + 1;
+    }
 
-                stack_pop(state);
-            }
+    return inst->next;
+}
 
-            log_verbose("Control flow forward jump search starting at %d\n", index);
+// Go forwards to the next control flow symbol
+int run_control_fast_forward(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
 
-            // Go forwards
-            for (int i = state->index; i < state->len; i++) {
+    if (state->control_flow_if_flag) {
+        em_stack_item* condition = stack_top(state);
 
-                if (state->code[i] == state->control_flow_token) {
-                    log_ingestion(state->code[i]);
-                    log_verbose("Control flow forward jump to index %d\n", i);
-                    return i;
-                }
-            }
+        if (condition == NULL) {
+            em_panic(state, "Operation fast-forward requires a ? on top the stack to check when if flag is set");
         }
-        break;
 
+        if (condition->code != '?') {
+            em_panic(state, "Operation fast-forward requires a ? on top the stack (found %c) to check when if flag is set", condition->code);
+        }
 
-        // perform a call
-        // We need
-        // <location>
-        // <arguments>
-        // Argument count as 4
-        case 'c':
-        {  
-            uint32_t argument_count = 0;
-            uint32_t jump_location = 0;
+        if (!condition->u.v_bool) {
+            stack_pop(state);
+            return inst->next;
+        }
 
-            em_stack_item* top = stack_top(state);
+        stack_pop(state);
+    }
 
-            if (top == NULL || top->code != '4') {
-                em_panic(state, "Call requires a 4 on stack top of number of arguments");
-            }
+    log_verbose("Control flow forward jump search starting at %d\n", state->index);
 
-            argument_count = top->u.v_int32;
+    // Go forwards
+    if (inst->operand.target == EM_TARGET_UNRESOLVED) {
+        inst->operand.target = find_marker(state, state->index, false);
+    }
 
-            em_stack_item* location = stack_top_minus(state, argument_count + 1);
+    if (inst->operand.target != -1) {
+        log_ingestion(state->code[inst->operand.target]);
+        log_verbose("Control flow forward jump to index %d\n", inst->operand.target);
+        return inst->operand.target + 1;
+    }
 
-            if (location == NULL || location->code != '^') {
-                em_panic(state, "Call expected a location to call into before %d arguments at stack top - %d", argument_count, argument_count + 1);
-            }
+    return inst->next;
+}
 
-            jump_location = location->u.v_int32;
+// Room for one more call frame
+static em_call_frame* push_frame(em_state* state) {
 
-            // Record where we return to
-            em_stack_item* return_to = stack_insert(state, argument_count + 2);
-            return_to->code = '^';
-            return_to->u.v_int32 = state->index+1;
+    if (state->frame_ptr + 1 >= state->max_frames) {
+        int max_frames = state->max_frames * 2;
+        em_call_frame* frames = em_perma_alloc(state, sizeof(em_call_frame) * max_frames);
 
-            // Jump
-            state->index = jump_location - 1;
+        memcpy(frames, state->frames, sizeof(em_call_frame) * state->max_frames);
+        em_perma_free(state, state->frames, sizeof(em_call_frame) * state->max_frames);
 
-            // Remove argument count
-            stack_pop(state);
+        state->frames = frames;
+        state->max_frames = max_frames;
+    }
 
-        }
-        break;
+    return &state->frames[++state->frame_ptr];
+}
 
-        // Return
-        //
-        // Expect
-        //
-        // [Location from]
-        // [Location in]
-        // [Return val]
-        // [Return val]
-        // [Quantity of returns as 4]
-        // 
-        case 'r':
-        {
-            uint32_t argument_count = 0;
-            uint32_t jump_location = 0;
+// Perform a call
+// We need
+// <location>
+// <arguments>
+// Argument count as 4
+int run_control_call(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
 
-            em_stack_item* top = stack_top(state);
+    uint32_t argument_count = 0;
+    uint32_t jump_location = 0;
 
-            if (top == NULL || top->code != '4') {
-                em_panic(state, "Return requires a 4 on stack top for number of results being returned");
-            }
+    em_stack_item* top = stack_top(state);
 
-            argument_count = top->u.v_int32;
+    if (top == NULL || top->code != '4') {
+        em_panic(state, "Call requires a 4 on stack top of number of arguments");
+    }
 
-            // Should be two locations before the arguments
+    argument_count = top->u.v_int32;
 
-            em_stack_item* location_in = stack_top_minus(state, argument_count + 1);
+    em_stack_item* location = stack_top_minus(state, argument_count + 1);
 
-            if (location_in == NULL || location_in->code != '^') {
-                em_panic(state, "Current function's location was expected at stack top - %d for return", argument_count + 1);
-            }
+    if (location == NULL || location->code != '^') {
+        em_panic(state, "Call expected a location to call into before %d arguments at stack top - %d", argument_count, argument_count + 1);
+    }
 
-            em_stack_item* location_return = stack_top_minus(state, argument_count + 2);
+    jump_location = location->u.v_int32;
+
+    // Remove argument count
+    stack_pop(state);
+
+    // Record where we return to
+    em_call_frame* frame = push_frame(state);
+    frame->return_to = state->index+1;
+    frame->base = state->stack_ptr - argument_count;
+    frame->argument_count = argument_count;
+
+    // Jump
+    return jump_location;
+}
+
+// Return
+//
+// Expect
+//
+// [Location in]
+// [Return val]
+// [Return val]
+// [Quantity of returns as 4]
+//
+// (where we came from is in the innermost call frame)
+int run_control_return(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Control flow)\n", inst->code);
+    log_ingestion(inst->code);
+
+    uint32_t argument_count = 0;
+    uint32_t jump_location = 0;
+
+    em_stack_item* top = stack_top(state);
+
+    if (top == NULL || top->code != '4') {
+        em_panic(state, "Return requires a 4 on stack top for number of results being returned");
+    }
 
-            if (location_return == NULL || location_return->code != '^') {
-                em_panic(state, "Return address location was expected at stack top - %d for return", argument_count + 1);
-            }
+    argument_count = top->u.v_int32;
 
-            jump_location = location_return->u.v_int32;
+    // Should be a location before the arguments
 
-            // Jump
-            state->index = jump_location;
+    em_stack_item* location_in = stack_top_minus(state, argument_count + 1);
 
-            // Drop the locations of where we came from and where we are
-            stack_drop(state, argument_count + 1);
-            stack_drop(state, argument_count + 1); // Would be +2 but the drop above changes its location
+    if (location_in == NULL || location_in->code != '^') {
+        em_panic(state, "Current function's location was expected at stack top - %d for return", argument_count + 1);
+    }
 
-            // Remove result count
-            stack_pop(state);
+    if (state->frame_ptr < 0) {
+        em_panic(state, "Return without a call to return from");
+    }
 
-        }
-        break;
+    em_call_frame* frame = &state->frames[state->frame_ptr];
 
-        default:
-            em_panic(state, "Unknown control flow instruction %c", current_code);
-            return 0;
+    // Drop the location of where we are: only the results above it move
+    int location_index = state->stack_ptr - (argument_count + 1);
 
+    // Whatever the function did with its arguments, only its results can be left above
+    // the location it was called at
+    if (location_index != frame->base) {
+        em_panic(state, "Return of %d results finds the location at stack index %d but it was called (with %d arguments) at %d",
+            argument_count, location_index, frame->argument_count, frame->base);
     }
 
-    return state->index;
-}
\ No newline at end of file
+    jump_location = frame->return_to;
+    state->frame_ptr--;
+
+    memmove(&state->stack[location_index], &state->stack[location_index + 1], sizeof(em_stack_item) * (argument_count + 1));
+    state->stack_ptr--;
+
+    // Remove result count
+    stack_pop(state);
+
+    // Jump: Resume after the return address (the character following the call)
+    return jump_location + 1;
+}
+
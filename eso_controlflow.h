@@ -1,4 +1,23 @@
 #pragma once
 #include "eso_vm.h"
 
-int run_control(em_state* state);
\ No newline at end of file
+// Rewind/fast-forward target not looked up yet
+#define EM_TARGET_UNRESOLVED -2
+
+void release_markers(em_state* state);
+int32_t find_marker(em_state* state, int index, bool backwards);
+em_label* find_label(em_state* state, const char* name, int length, uint32_t hash);
+
+int run_control_marker(em_state* state, em_instruction* inst);
+int run_control_exit(em_state* state, em_instruction* inst);
+int run_control_label(em_state* state, em_instruction* inst);
+int run_control_forward_declare(em_state* state, em_instruction* inst);
+int run_control_jump(em_state* state, em_instruction* inst);
+int run_control_get_label(em_state* state, em_instruction* inst);
+int run_control_if(em_state* state, em_instruction* inst);
+int run_control_line(em_state* state, em_instruction* inst);
+int run_control_set_token(em_state* state, em_instruction* inst);
+int run_control_rewind(em_state* state, em_instruction* inst);
+int run_control_fast_forward(em_state* state, em_instruction* inst);
+int run_control_call(em_state* state, em_instruction* inst);
+int run_control_return(em_state* state, em_instruction* inst);
\ No newline at end of file
@@ -21,6 +21,10 @@ void print_memory_use(em_state* state) {
         state->memory_parser.allocated,
         state->memory_parser.peak_allocated);
 
+    log_printf("BYTECODE \t\tA:%10db\tP:%10db\n\n",
+        state->memory_bytecode.allocated,
+        state->memory_bytecode.peak_allocated);
+
     log_printf("USERCODE \t\tA:%10db\tP:%10db\t\n\t\t\tO:%10db\tP:%10db\n",
         state->memory_usercode.allocated,
         state->memory_usercode.peak_allocated,
@@ -30,6 +34,9 @@ void print_memory_use(em_state* state) {
 
 void assert_no_leak(em_state* state) {
 
+    // Anything still waiting to be freed isn't a leak
+    em_free_unreferenced(state);
+
     if (state->memory_usercode.allocated != 0) {
         log_printf( "\033[0;31m********\n\n\nUSERCODE MEMORY LEAK (%db)\n\n\n********\033[0;0m\n", state->memory_usercode.allocated);
         print_memory_use(state);
@@ -107,121 +114,149 @@ void inspect_pointer(em_state* state, em_managed_ptr* ptr, int tab_start) {
     }
 }
 
-int run_debug(em_state* state) {
+int run_debug_stack(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
 
-    char current_code = tolower(state->code[state->index]);
+    dump_stack(state);
+    return inst->next;
+}
 
-    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", current_code);
-    log_ingestion(current_code);
+int run_debug_trace(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
 
-    switch(current_code) {
+    dump_instructions(state);
+    return inst->next;
+}
 
-        // Stack
-        case 's':
-        dump_stack(state);
-        return 0;
+int run_debug_types(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
 
-        // Trace
-        case 't':
-        dump_instructions(state);
-        break;
+    dump_types(state);
+    return inst->next;
+}
 
-        // Type map
-        case 'u':
-        dump_types(state);
-        break;
+// Which fusions the compiler made and how often each ran as one instruction
+void dump_fusions(em_state* state) {
 
-        case 'r': 
-        print_memory_use(state);
-        break;
+    static const char* names[EM_FUSION_COUNT] = {
+        [EM_FUSION_ADD_IMMEDIATE] = "add immediate",
+        [EM_FUSION_GET_LABEL] = "get label",
+        [EM_FUSION_STACK_COPY] = "stack copy",
+        [EM_FUSION_COMPARE_BRANCH] = "compare and branch",
+    };
 
-        // Inspect stack top
-        case 'i':
-        {
-            em_stack_item* top = stack_top(state);
+    log_printf("FUSION            	%10s	%12s	%12s\n", "SITES", "RUNS", "FALLBACKS");
 
-            if (top == NULL || !is_code_using_managed_memory(top->code)) {
-                log_printf("Ignoring debug inspect request: Requires type of u, s or * on stack top\n");
-                return 0;
-            }
+    for (int f = 0; f < EM_FUSION_COUNT; f++) {
+        log_printf("%-18s\t%10u\t%12llu\t%12llu\n",
+            names[f],
+            state->fusion_sites[f],
+            (unsigned long long)state->fusion_runs[f],
+            (unsigned long long)state->fusion_fallbacks[f]);
+    }
+}
 
-            if (top->u.v_mptr == state->null) {
-                log_printf("NULL");
-            } else {
-                inspect_pointer(state, top->u.v_mptr, 0);
-            }
-        }
-        break;
+int run_debug_fusions(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
 
-        // Assert line
-        case 'l':
-        {   
-            int size_to_skip  = 0;
-            char* test = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);        
+    dump_fusions(state);
+    return inst->next;
+}
 
-            if (test == NULL) {
-                em_panic(state, "Could not find a complete literal for line assertion: Did you forget to terminate it?");
-            }
+int run_debug_memory(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
 
-            uint32_t v = atoi(test);
-            em_parser_free(state, test);
-            uint32_t real_line = calculate_file_line(state);
+    print_memory_use(state);
+    return inst->next;
+}
 
-            if (real_line != v) {
-                em_panic(state, "Line assertion failed: Expected to be on line %d actually on line %d", v, real_line);
-            }
+// Inspect stack top
+int run_debug_inspect(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
 
-            return size_to_skip;
-        }
+    em_stack_item* top = stack_top(state);
 
-        // Assert that the two stack items present contain equivalent values
-        case 'a':
-        {
-            em_stack_item* one = stack_top_minus(state, 1);
-            em_stack_item* two = stack_top(state);
+    if (top == NULL || !is_code_using_managed_memory(top->code)) {
+        log_printf("Ignoring debug inspect request: Requires type of u, s or * on stack top\n");
+        return inst->next;
+    }
 
-            if (one == NULL || two == NULL) {
-                em_panic(state, "Operation assert requires two items on the stack to compare");
-            }
+    if (top->u.v_mptr == state->null) {
+        log_printf("NULL");
+    } else {
+        inspect_pointer(state, top->u.v_mptr, 0);
+    }
 
-            if (one->code == 's' && two->code == 's') {
-                // Do a string compare
-                //
+    return inst->next;
+}
 
-                if (one->u.v_mptr == state->null || two->u.v_mptr == state->null) {
+// Assert line
+int run_debug_assert_line(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
 
-                    // Must both be null
-                    if (!(one->u.v_mptr == state->null && two->u.v_mptr == state->null)) {
-                        em_panic(state, "Assertion failed (comparison with at least one NULL)");
-                    }
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for line assertion: Did you forget to terminate it?");
+    }
 
-                } else {
+    uint32_t v = inst->operand.line;
+    uint32_t real_line = calculate_file_line(state);
 
-                    if (strcmp((const char*)one->u.v_mptr->raw, (const char*)two->u.v_mptr->raw) != 0) {
-                        em_panic(state, "Assertion failed (string compare)");
-                    }
-                }   
-            } else {
+    if (real_line != v) {
+        em_panic(state, "Line assertion failed: Expected to be on line %d actually on line %d", v, real_line);
+    }
 
-                if (memcmp(&one->u, &two->u, sizeof(one->u)) != 0) {
-                    em_panic(state, "Assertion failed (%p vs. %p)", &one->u, &two->u);
-                }
+    return inst->next;
+}
+
+// Assert that the two stack items present contain equivalent values
+int run_debug_assert(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Debug)\n", inst->code);
+    log_ingestion(inst->code);
+
+    em_stack_item* one = stack_top_minus(state, 1);
+    em_stack_item* two = stack_top(state);
+
+    if (one == NULL || two == NULL) {
+        em_panic(state, "Operation assert requires two items on the stack to compare");
+    }
+
+    if (one->code == 's' && two->code == 's') {
+        // Do a string compare
+        //
+
+        if (one->u.v_mptr == state->null || two->u.v_mptr == state->null) {
+
+            // Must both be null
+            if (!(one->u.v_mptr == state->null && two->u.v_mptr == state->null)) {
+                em_panic(state, "Assertion failed (comparison with at least one NULL)");
             }
 
-            stack_pop(state);
-            stack_pop(state);
-            
-            log_verbose("Assertion successful\n");
-        }
-        break;
+        } else {
 
-        default:
-            em_panic(state, "Unknown debug instruction %c", current_code);
-            return 0;
+            if (strcmp((const char*)one->u.v_mptr->raw, (const char*)two->u.v_mptr->raw) != 0) {
+                em_panic(state, "Assertion failed (string compare)");
+            }
+        }
+    } else {
 
+        if (memcmp(&one->u, &two->u, sizeof(one->u)) != 0) {
+            em_panic(state, "Assertion failed (%p vs. %p)", &one->u, &two->u);
+        }
     }
 
-    return 0;
+    stack_pop(state);
+    stack_pop(state);
+
+    log_verbose("Assertion successful\n");
+
+    return inst->next;
 }
 
 void dump_stack_item(em_state* state, em_stack_item* item, int relative_index, int top_index) {
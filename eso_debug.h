@@ -2,7 +2,14 @@
 
 void assert_no_leak(em_state* state);
 
-int run_debug(em_state* state);
+int run_debug_stack(em_state* state, em_instruction* inst);
+int run_debug_trace(em_state* state, em_instruction* inst);
+int run_debug_types(em_state* state, em_instruction* inst);
+int run_debug_memory(em_state* state, em_instruction* inst);
+int run_debug_inspect(em_state* state, em_instruction* inst);
+int run_debug_assert_line(em_state* state, em_instruction* inst);
+int run_debug_assert(em_state* state, em_instruction* inst);
+int run_debug_fusions(em_state* state, em_instruction* inst);
 
 void dump_stack_item(em_state* state, em_stack_item* item, int relative_index, int top_index);
 
@@ -12,6 +19,8 @@ void dump_types(em_state* state);
 
 void dump_instructions(em_state* state);
 
+void dump_fusions(em_state* state);
+
 const char* code_colour_code(char code);
 
 void dump_pointers(em_state* state);
\ No newline at end of file
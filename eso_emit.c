@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "eso_vm.h"
+#include "eso_log.h"
+#include "eso_bytecode.h"
+#include "eso_controlflow.h"
+#include "eso_emit.h"
+
+// Ahead of time translation to C.
+//
+// Every instruction em_compile decoded becomes a labelled call to its run_* handler,
+// followed by gotos to wherever it can statically go next (the next instruction, the
+// end of a fused sequence, the marker a rewind or fast-forward lands on). Anything
+// else (labels, line jumps, calls and returns) goes through a switch on the source
+// index back into the same labels.
+//
+// The generated program carries its source and compiles it again at startup so every
+// instruction it refers to is decoded exactly as it was here. The straight-line code
+// only holds while that's still true: once the runtime decodes anything on demand (a
+// jump into code in a different mode) the rest of the program runs interpreted.
+
+// Source index execution goes on from after inst returned index, or -1 for the end
+static int32_t static_slot(em_state* state, int index) {
+
+    if (index < 0 || index >= state->len) {
+        return -1;
+    }
+
+    return state->instruction_at[index];
+}
+
+static void emit_successor(em_state* state, FILE* out, int index, int* emitted, int* emitted_count) {
+
+    for (int i = 0; i < *emitted_count; i++) {
+        if (emitted[i] == index) {
+            return;
+        }
+    }
+
+    emitted[(*emitted_count)++] = index;
+
+    int32_t slot = static_slot(state, index);
+
+    if (slot >= 0) {
+        fprintf(out, "    if (next == %d) goto i_%d;\n", index, state->instructions[slot].index);
+    } else if (index >= 0 && (index >= state->len || slot == -2)) {
+        // Nothing but whitespace from here
+        fprintf(out, "    if (next == %d) return;\n", index);
+    }
+}
+
+// The handler can be switched out as it runs by quickening: call whatever it is now
+static bool is_quickened(uint16_t opcode) {
+    return opcode == EM_OP_BOOLEAN_ADD || opcode == EM_OP_BOOLEAN_LESS || opcode == EM_OP_BOOLEAN_GREATER;
+}
+
+static void emit_instruction(em_state* state, FILE* out, int32_t slot) {
+
+    em_instruction* inst = &state->instructions[slot];
+
+    fprintf(out, "i_%d: // %s\n", inst->index, em_op_handler_names[inst->opcode]);
+
+    // Mode changes mean the same in any mode
+    if (inst->opcode == EM_OP_MODE) {
+        fprintf(out, "    EM_AT_ANY_MODE(%d);\n", inst->index);
+    } else {
+        fprintf(out, "    EM_AT(%d, %d, %d);\n", inst->index, inst->mode, inst->control_flow_token);
+    }
+
+    if (is_quickened(inst->opcode)) {
+        fprintf(out, "    next = em_op_handlers[state->instructions[%d].opcode](state, &state->instructions[%d]);\n", slot, slot);
+    } else {
+        fprintf(out, "    next = %s(state, &state->instructions[%d]);\n", em_op_handler_names[inst->opcode], slot);
+    }
+
+    int emitted[4];
+    int emitted_count = 0;
+
+    emit_successor(state, out, inst->next, emitted, &emitted_count);
+
+    switch(inst->opcode) {
+        case EM_OP_FUSED_ADD_IMMEDIATE:
+        case EM_OP_FUSED_GET_LABEL:
+        case EM_OP_FUSED_STACK_COPY:
+            emit_successor(state, out, inst->fused.next, emitted, &emitted_count);
+        break;
+
+        case EM_OP_FUSED_COMPARE_BRANCH: {
+            emit_successor(state, out, inst->fused.next, emitted, &emitted_count);
+
+            int32_t marker = find_marker(state, inst->fused.branch, inst->fused.backwards);
+
+            if (marker != -1) {
+                emit_successor(state, out, marker + 1, emitted, &emitted_count);
+            }
+        }
+        break;
+
+        case EM_OP_CONTROL_REWIND:
+        case EM_OP_CONTROL_FAST_FORWARD: {
+            int32_t marker = find_marker(state, inst->index, inst->opcode == EM_OP_CONTROL_REWIND);
+
+            if (marker != -1) {
+                emit_successor(state, out, marker + 1, emitted, &emitted_count);
+            }
+        }
+        break;
+    }
+
+    fprintf(out, "    goto dispatch;\n\n");
+}
+
+// A C string literal of length characters
+static void emit_string(FILE* out, const char* text, int length) {
+
+    fprintf(out, "\"");
+
+    for (int i = 0; i < length; i++) {
+        unsigned char c = text[i];
+
+        if (c == '\n') {
+            fprintf(out, "\\n\"\n    \"");
+        } else if (c == '"' || c == '\\' || c == '?') {
+            fprintf(out, "\\%c", c);
+        } else if (isprint(c)) {
+            fprintf(out, "%c", c);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+
+    fprintf(out, "\"");
+}
+
+void em_emit_c(em_state* state, FILE* out, int source_size) {
+
+    fprintf(out, "// Generated by eb --emit-c from %s\n", state->filename);
+    fprintf(out, "// Build with every esobase source file except main.c, e.g.\n");
+    fprintf(out, "//     cc -I<esobase> this.c $(ls <esobase>/*.c | grep -v main.c)\n\n");
+
+    fprintf(out, "#include <stdlib.h>\n");
+    fprintf(out, "#include <string.h>\n");
+    fprintf(out, "#include <stdio.h>\n\n");
+    fprintf(out, "#include \"eso_vm.h\"\n");
+    fprintf(out, "#include \"eso_log.h\"\n");
+    fprintf(out, "#include \"eso_bytecode.h\"\n");
+    fprintf(out, "#include \"eso_debug.h\"\n\n");
+
+    // Handlers (each declared once)
+    bool declared[EM_OP_COUNT];
+    memset(declared, 0, sizeof(declared));
+
+    for (int slot = 0; slot <= state->instruction_ptr; slot++) {
+        uint16_t opcode = state->instructions[slot].opcode;
+
+        if (!declared[opcode] && !is_quickened(opcode)) {
+            fprintf(out, "int %s(em_state* state, em_instruction* inst);\n", em_op_handler_names[opcode]);
+            declared[opcode] = true;
+        }
+    }
+
+    fprintf(out, "\nstatic const char em_source[] =\n    ");
+    emit_string(out, state->code, state->len);
+    fprintf(out, ";\n\n");
+
+    fprintf(out, "#define EM_SOURCE_SIZE %d\n", source_size);
+    fprintf(out, "#define EM_SOURCE_LENGTH %d\n", state->len);
+    fprintf(out, "#define EM_INSTRUCTIONS %d\n\n", state->instruction_ptr + 1);
+
+    fprintf(out, "// Only run the instruction as compiled if nothing has been decoded since and we're\n");
+    fprintf(out, "// in the mode it was decoded for. Otherwise the interpreter takes it from here\n");
+    fprintf(out, "#define EM_AT_ANY_MODE(at) \\\n");
+    fprintf(out, "    if (state->decode_generation != generation) { next = at; goto interpret; } \\\n");
+    fprintf(out, "    state->index = at;\n\n");
+    fprintf(out, "#define EM_AT(at, mode_decoded, token) \\\n");
+    fprintf(out, "    if (state->decode_generation != generation || state->mode != (ESOMODE)mode_decoded || \\\n");
+    fprintf(out, "        (state->mode == EM_CONTROL_FLOW && state->control_flow_token != token)) { next = at; goto interpret; } \\\n");
+    fprintf(out, "    state->index = at;\n\n");
+
+    fprintf(out, "static void run_program(em_state* state, uint32_t generation) {\n\n");
+    fprintf(out, "    int next = 0;\n");
+    fprintf(out, "    em_instruction* inst = NULL;\n\n");
+    fprintf(out, "    goto dispatch;\n\n");
+
+    for (int slot = 0; slot <= state->instruction_ptr; slot++) {
+        emit_instruction(state, out, slot);
+    }
+
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    if (next < 0 || next >= EM_SOURCE_LENGTH) {\n");
+    fprintf(out, "        return;\n");
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    if (state->decode_generation == generation) {\n");
+    fprintf(out, "        switch(next) {\n");
+
+    // Every source index em_compile resolved to an instruction
+    for (int slot = 0; slot <= state->instruction_ptr; slot++) {
+        bool any = false;
+
+        for (int index = 0; index < state->len; index++) {
+            if (state->instruction_at[index] == slot) {
+                fprintf(out, "%scase %d:", any ? " " : "            ", index);
+                any = true;
+            }
+        }
+
+        if (any) {
+            fprintf(out, " goto i_%d;\n", state->instructions[slot].index);
+        }
+    }
+
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n\n");
+
+    fprintf(out, "interpret:\n");
+    fprintf(out, "    inst = em_fetch(state, next);\n\n");
+    fprintf(out, "    if (inst == NULL) {\n");
+    fprintf(out, "        return;\n");
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    state->index = inst->index;\n");
+    fprintf(out, "    next = em_op_handlers[inst->opcode](state, inst);\n");
+    fprintf(out, "    goto dispatch;\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "int main(int argc, char** argv) {\n\n");
+    fprintf(out, "    em_state* state = create_state(");
+    emit_string(out, state->filename, strlen(state->filename));
+    fprintf(out, ");\n\n");
+    fprintf(out, "    char* code = em_perma_alloc(state, EM_SOURCE_SIZE + 1);\n");
+    fprintf(out, "    memset(code, 0, EM_SOURCE_SIZE + 1);\n");
+    fprintf(out, "    memcpy(code, em_source, EM_SOURCE_LENGTH);\n\n");
+    fprintf(out, "    state->code = code;\n");
+    fprintf(out, "    state->len = EM_SOURCE_LENGTH;\n\n");
+    fprintf(out, "    em_compile(state);\n\n");
+    fprintf(out, "    if (state->instruction_ptr + 1 != EM_INSTRUCTIONS) {\n");
+    fprintf(out, "        log_printf(\"Generated for a different esobase runtime (%%d instructions, expected %%d)\\n\", state->instruction_ptr + 1, EM_INSTRUCTIONS);\n");
+    fprintf(out, "        exit(1);\n");
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    run_program(state, state->decode_generation);\n");
+    fprintf(out, "    assert_no_leak(state);\n");
+    fprintf(out, "    destroy_state(state);\n\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+
+    log_verbose("Emitted C for %d instructions\n", state->instruction_ptr + 1);
+}
\ No newline at end of file
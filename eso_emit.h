@@ -0,0 +1,7 @@
+#pragma once
+#include <stdio.h>
+#include "eso_vm.h"
+
+// Write a standalone C program equivalent to the compiled state (see eso_emit.c).
+// source_size is the size of the file the code was read from
+void em_emit_c(em_state* state, FILE* out, int source_size);
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "eso_vm.h"
+#include "eso_log.h"
+#include "eso_parse.h"
+#include "eso_stack.h"
+#include "eso_bytecode.h"
+#include "eso_controlflow.h"
+#include "eso_fusion.h"
+
+// Fusion rewrites the first instruction of a common sequence into one instruction
+// that does the work of the whole sequence and resumes after it. The rest of the
+// sequence is left decoded as it was, so jumping into the middle of it still works.
+//
+// Every fused instruction checks what it relies on (operand types, the control flow
+// symbol) first and runs the sequence one instruction at a time if that doesn't hold
+
+// The instruction em_compile decoded straight after inst
+static em_instruction* following(em_state* state, em_instruction* inst) {
+
+    if (inst == NULL) {
+        return NULL;
+    }
+
+    int32_t slot = (inst - state->instructions) + 1;
+
+    return slot <= state->instruction_ptr ? &state->instructions[slot] : NULL;
+}
+
+static bool is_mode_change_to(em_state* state, em_instruction* inst, ESOMODE mode) {
+    return inst != NULL && inst->opcode == EM_OP_MODE && inst->index + 1 < state->len && inst->operand.mode == mode;
+}
+
+static void fuse(em_state* state, em_instruction* first, ESOFUSION fusion, uint16_t opcode, em_instruction* mode_change, em_instruction* last) {
+
+    first->fused.opcode = first->opcode;
+    first->fused.next = last->next;
+    first->fused.mode_change = mode_change->index;
+    first->fused.target = EM_TARGET_UNRESOLVED;
+    first->opcode = opcode;
+
+    state->fusion_sites[fusion]++;
+
+    log_verbose("Fused %d to %d into opcode %d (resume at %d)\n", first->index, last->index, opcode, first->fused.next);
+}
+
+// mb < or > then mf < or >. Loops commonly toggle the if flag in between too
+static void fuse_compare_branch(em_state* state, em_instruction* first, em_instruction* mode_change) {
+
+    if (!is_mode_change_to(state, mode_change, EM_CONTROL_FLOW)) {
+        return;
+    }
+
+    em_instruction* last = following(state, mode_change);
+    bool toggles_if = false;
+
+    if (last != NULL && last->opcode == EM_OP_CONTROL_IF) {
+        toggles_if = true;
+        last = following(state, last);
+
+        // mf i mf > spells out the mode change again
+        if (is_mode_change_to(state, last, EM_CONTROL_FLOW)) {
+            mode_change = last;
+            last = following(state, last);
+        }
+    }
+
+    if (last == NULL || (last->opcode != EM_OP_CONTROL_REWIND && last->opcode != EM_OP_CONTROL_FAST_FORWARD)) {
+        return;
+    }
+
+    first->fused.branch = last->index;
+    first->fused.backwards = (last->opcode == EM_OP_CONTROL_REWIND);
+    first->fused.toggles_if = toggles_if;
+
+    fuse(state, first, EM_FUSION_COMPARE_BRANCH, EM_OP_FUSED_COMPARE_BRANCH, mode_change, last);
+}
+
+// The constant offset of ml <n>; ms c or 0 if it can't be fused
+static uint32_t literal_stack_offset(uint16_t opcode, em_instruction* inst) {
+    switch(opcode) {
+        case EM_OP_LITERAL_U8: return inst->operand.literal.u.v_byte;
+        case EM_OP_LITERAL_U16: return inst->operand.literal.u.v_int16;
+        case EM_OP_LITERAL_U32: return inst->operand.literal.u.v_int32;
+    }
+
+    return 0;
+}
+
+// Only looks at what em_compile decoded in order, so must run straight after it
+void em_fuse(em_state* state) {
+
+    for (int slot = 0; slot <= state->instruction_ptr; slot++) {
+
+        em_instruction* first = &state->instructions[slot];
+        em_instruction* mode_change = following(state, first);
+        em_instruction* last = following(state, mode_change);
+
+        // Everything fused is at least an instruction, a mode change and an instruction
+        if (last == NULL) {
+            break;
+        }
+
+        switch(first->opcode) {
+            case EM_OP_LITERAL_U8:
+            case EM_OP_LITERAL_U16:
+            case EM_OP_LITERAL_U32:
+            case EM_OP_LITERAL_U64:
+            case EM_OP_LITERAL_F32:
+            case EM_OP_LITERAL_F64:
+                if (first->unterminated) {
+                    break;
+                }
+
+                if (is_mode_change_to(state, mode_change, EM_BOOLEAN) && last->opcode == EM_OP_BOOLEAN_ADD) {
+                    fuse(state, first, EM_FUSION_ADD_IMMEDIATE, EM_OP_FUSED_ADD_IMMEDIATE, mode_change, last);
+
+                } else if (is_mode_change_to(state, mode_change, EM_STACK) && last->opcode == EM_OP_STACK_COPY &&
+                    literal_stack_offset(first->opcode, first) > 0) {
+                    fuse(state, first, EM_FUSION_STACK_COPY, EM_OP_FUSED_STACK_COPY, mode_change, last);
+                }
+            break;
+
+            case EM_OP_LITERAL_STRING:
+                if (!first->unterminated && is_mode_change_to(state, mode_change, EM_CONTROL_FLOW) &&
+                    last->opcode == EM_OP_CONTROL_GET_LABEL) {
+                    first->fused.hash = hash_span(state->code + first->operand.text.start, first->operand.text.length);
+                    fuse(state, first, EM_FUSION_GET_LABEL, EM_OP_FUSED_GET_LABEL, mode_change, last);
+                }
+            break;
+
+            case EM_OP_BOOLEAN_LESS:
+            case EM_OP_BOOLEAN_GREATER:
+                fuse_compare_branch(state, first, mode_change);
+            break;
+        }
+    }
+}
+
+// Run just the first instruction of the sequence and carry on from there as normal
+static int run_unfused(em_state* state, em_instruction* inst, ESOFUSION fusion) {
+
+    state->fusion_fallbacks[fusion]++;
+
+    uint16_t fused_opcode = inst->opcode;
+
+    inst->opcode = inst->fused.opcode;
+    int next = em_op_handlers[inst->opcode](state, inst);
+
+    // (Quickening may have rewritten the opcode as it ran)
+    inst->opcode = fused_opcode;
+
+    return next;
+}
+
+// Finish the sequence in the mode it ends in
+int em_end_fused(em_state* state, em_instruction* inst, ESOFUSION fusion, ESOMODE mode) {
+
+    state->mode = mode;
+    state->last_mode_change = inst->fused.mode_change;
+    state->fusion_runs[fusion]++;
+
+    return inst->fused.next;
+}
+
+// ml <n>; mb +
+int run_fused_add_immediate(em_state* state, em_instruction* inst) {
+
+    em_stack_item* literal = &inst->operand.literal;
+    em_stack_item* top = stack_top(state);
+
+    // (A full stack panics pushing the literal in the unfused sequence)
+    if (top == NULL || top->code != literal->code || (state->stack_ptr + 1) >= state->stack_size) {
+        return run_unfused(state, inst, EM_FUSION_ADD_IMMEDIATE);
+    }
+
+    log_verbose("\033[0;31m%c\033[0;0m (Fused add immediate)\n", inst->code);
+    log_ingestion(inst->code);
+
+    em_stack_item result;
+    memset(&result, 0, sizeof(em_stack_item));
+    result.code = literal->code;
+
+    switch(literal->code) {
+        case '1': result.u.v_byte = top->u.v_byte + literal->u.v_byte; break;
+        case '2': result.u.v_int16 = top->u.v_int16 + literal->u.v_int16; break;
+        case '4': result.u.v_int32 = top->u.v_int32 + literal->u.v_int32; break;
+        case '8': result.u.v_int64 = top->u.v_int64 + literal->u.v_int64; break;
+        case 'f': result.u.v_float = top->u.v_float + literal->u.v_float; break;
+        case 'd': result.u.v_double = top->u.v_double + literal->u.v_double; break;
+    }
+
+    *top = result;
+
+    return em_end_fused(state, inst, EM_FUSION_ADD_IMMEDIATE, EM_BOOLEAN);
+}
+
+// ml s <name>; mf g
+int run_fused_get_label(em_state* state, em_instruction* inst) {
+
+    // g only gets a label if it isn't the control flow symbol
+    if (inst->control_flow_token != state->control_flow_token) {
+        return run_unfused(state, inst, EM_FUSION_GET_LABEL);
+    }
+
+    em_label* label = find_label(state, state->code + inst->operand.text.start, inst->operand.text.length, inst->fused.hash);
+
+    // Let mf g report it
+    if (label == NULL) {
+        return run_unfused(state, inst, EM_FUSION_GET_LABEL);
+    }
+
+    log_verbose("\033[0;31m%c\033[0;0m (Fused get label)\n", inst->code);
+    log_ingestion(inst->code);
+
+    int top = stack_push(state);
+
+    state->stack[top].u.v_int32 = label->location;
+    state->stack[top].code = '^';
+
+    return em_end_fused(state, inst, EM_FUSION_GET_LABEL, EM_CONTROL_FLOW);
+}
+
+// ml <n>; ms c
+int run_fused_stack_copy(em_state* state, em_instruction* inst) {
+
+    uint32_t minus = literal_stack_offset(inst->fused.opcode, inst);
+
+    // The offset counts itself, but is never pushed here
+    em_stack_item* to_copy = stack_top_minus(state, minus - 1);
+
+    if (to_copy == NULL) {
+        return run_unfused(state, inst, EM_FUSION_STACK_COPY);
+    }
+
+    log_verbose("\033[0;31m%c\033[0;0m (Fused stack copy)\n", inst->code);
+    log_ingestion(inst->code);
+
+    int ptr = stack_push(state);
+
+    // Copy is a reference
+    if (is_code_using_managed_memory(to_copy->code)) {
+        em_managed_ptr* reference = to_copy->u.v_mptr;
+
+        if (reference != state->null) {
+            em_add_stack_reference(state, reference); // Stack holds a reference
+        }
+
+        state->stack[ptr].u.v_mptr = reference;
+        state->stack[ptr].code = to_copy->code;
+
+    } else {
+        memcpy(&state->stack[ptr], to_copy, sizeof(em_stack_item));
+    }
+
+    return em_end_fused(state, inst, EM_FUSION_STACK_COPY, EM_STACK);
+}
+
+// mb < or > then mf < or >
+int run_fused_compare_branch(em_state* state, em_instruction* inst) {
+
+    em_stack_item* one = stack_top_minus(state, 1);
+    em_stack_item* two = stack_top(state);
+
+    if (one == NULL || two == NULL || one->code != two->code || inst->control_flow_token != state->control_flow_token) {
+        return run_unfused(state, inst, EM_FUSION_COMPARE_BRANCH);
+    }
+
+    bool less = (inst->fused.opcode == EM_OP_BOOLEAN_LESS);
+    bool result = false;
+
+    switch(one->code) {
+        case '1': result = less ? one->u.v_byte < two->u.v_byte : one->u.v_byte > two->u.v_byte; break;
+        case '2': result = less ? one->u.v_int16 < two->u.v_int16 : one->u.v_int16 > two->u.v_int16; break;
+        case '4': result = less ? one->u.v_int32 < two->u.v_int32 : one->u.v_int32 > two->u.v_int32; break;
+        case '8': result = less ? one->u.v_int64 < two->u.v_int64 : one->u.v_int64 > two->u.v_int64; break;
+        case 'f': result = less ? one->u.v_float < two->u.v_float : one->u.v_float > two->u.v_float; break;
+        case 'd': result = less ? one->u.v_double < two->u.v_double : one->u.v_double > two->u.v_double; break;
+
+        default:
+            return run_unfused(state, inst, EM_FUSION_COMPARE_BRANCH);
+    }
+
+    log_verbose("\033[0;31m%c\033[0;0m (Fused compare and branch)\n", inst->code);
+    log_ingestion(inst->code);
+
+    // Numbers: nothing to release
+    state->stack_ptr -= 2;
+
+    if (inst->fused.toggles_if) {
+        state->control_flow_if_flag = !state->control_flow_if_flag;
+    }
+
+    int next = em_end_fused(state, inst, EM_FUSION_COMPARE_BRANCH, EM_CONTROL_FLOW);
+
+    if (state->control_flow_if_flag) {
+
+        if (!result) {
+            return next;
+        }
+
+    } else {
+
+        // Unconditional jump: the result stays on the stack
+        int top = stack_push(state);
+        state->stack[top].u.v_bool = result;
+        state->stack[top].code = '?';
+    }
+
+    if (inst->fused.target == EM_TARGET_UNRESOLVED) {
+        inst->fused.target = find_marker(state, inst->fused.branch, inst->fused.backwards);
+    }
+
+    if (inst->fused.target == -1) {
+        return next;
+    }
+
+    return inst->fused.target + 1;
+}
\ No newline at end of file
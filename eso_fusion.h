@@ -0,0 +1,13 @@
+#pragma once
+#include "eso_vm.h"
+
+// Fusion is on by default. Build with -DESO_NO_FUSION to run every instruction on its own
+void em_fuse(em_state* state);
+
+// Finish a fused sequence in the mode it ends in, returning where it resumes
+int em_end_fused(em_state* state, em_instruction* inst, ESOFUSION fusion, ESOMODE mode);
+
+int run_fused_add_immediate(em_state* state, em_instruction* inst);
+int run_fused_get_label(em_state* state, em_instruction* inst);
+int run_fused_stack_copy(em_state* state, em_instruction* inst);
+int run_fused_compare_branch(em_state* state, em_instruction* inst);
\ No newline at end of file
@@ -0,0 +1,422 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "eso_vm.h"
+#include "eso_log.h"
+#include "eso_bytecode.h"
+#include "eso_jit.h"
+
+// Baseline template JIT for loops.
+//
+// Instructions reached by jumping backwards count how often that happens. Once one
+// passes state->jit_threshold the interpreter records the instructions of the next trip
+// around the loop (and what each one returned). That recording is stitched into native
+// code from per-instruction templates: a few simple instructions are done inline, the
+// rest call their run_* handler exactly as the interpreter would.
+//
+// Every handler call is followed by a check that it returned the same next index as when
+// recorded. Anything else (leaving the loop, an if going the other way, a guard in a
+// fused or quickened instruction) drops back to the interpreter at that index.
+//
+// A trace only stands while nothing has been decoded since it was recorded (so every
+// slot it refers to means the same thing) and is only entered in the mode and with the
+// control flow symbol it was recorded under.
+//
+// JIT memory is deliberately kept out of the bookkeeping so --jit doesn't change what
+// md r reports.
+
+#ifdef ESO_JIT
+
+#include <sys/mman.h>
+
+#define EM_JIT_MAX_TRACE 512
+#define EM_JIT_NEVER UINT16_MAX // hotness of an instruction that can't start a trace (see EM_JIT_MAX_THRESHOLD)
+
+typedef int (*em_trace)(em_state* state);
+
+typedef struct {
+    em_trace run;
+    void* code;
+    size_t size;
+
+    // What the trace was recorded under
+    ESOMODE mode;
+    uint8_t control_flow_token;
+    uint32_t generation;
+} em_jit_trace;
+
+struct t_em_jit {
+    em_jit_trace* traces;
+    int trace_count;
+    int max_traces;
+
+    // The trace being recorded: -1 if none
+    int32_t recording_head;
+    ESOMODE recording_mode;
+    uint8_t recording_token;
+    uint32_t recording_generation;
+
+    int32_t slots[EM_JIT_MAX_TRACE];    // Instruction slot of each instruction in order
+    int32_t expected[EM_JIT_MAX_TRACE]; // What each one returned
+    int recorded;
+};
+
+bool em_jit_available() {
+    return true;
+}
+
+//
+// x86-64 encoding
+//
+
+typedef struct {
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+} em_emitter;
+
+// Make room for size more bytes. compile_trace sizes the buffer up front so this
+// should only ever grow it if a template outgrows EM_JIT_MAX_TEMPLATE
+static void reserve(em_emitter* e, size_t size) {
+
+    if (e->length + size <= e->capacity) {
+        return;
+    }
+
+    while (e->length + size > e->capacity) {
+        e->capacity *= 2;
+    }
+
+    e->bytes = realloc(e->bytes, e->capacity);
+}
+
+static void emit8(em_emitter* e, uint8_t value) {
+    reserve(e, 1);
+    e->bytes[e->length++] = value;
+}
+
+static void emit32(em_emitter* e, uint32_t value) {
+    reserve(e, 4);
+    memcpy(e->bytes + e->length, &value, 4);
+    e->length += 4;
+}
+
+static void emit64(em_emitter* e, uint64_t value) {
+    reserve(e, 8);
+    memcpy(e->bytes + e->length, &value, 8);
+    e->length += 8;
+}
+
+// Patch a rel32 at offset to land on target
+static void patch_rel32(em_emitter* e, size_t offset, size_t target) {
+    int32_t relative = (int32_t)(target - (offset + 4));
+    memcpy(e->bytes + offset, &relative, 4);
+}
+
+// mov dword [rbx + field], value
+static void emit_store_state32(em_emitter* e, size_t field, uint32_t value) {
+    emit8(e, 0xC7); emit8(e, 0x83); emit32(e, field); emit32(e, value);
+}
+
+// Longest any one template can be: emit_call's store (10), mov (7), add (7), mov (3),
+// movzx (7), call (4), cmp (5) and jne (6)
+#define EM_JIT_MAX_TEMPLATE 49
+
+//
+// Templates
+//
+
+// Instructions whose effect is fixed by how they were decoded. Only used where the
+// recording saw them continue to the next instruction as usual
+static bool emit_inline(em_emitter* e, em_instruction* inst, int expected) {
+
+    if (expected != inst->next) {
+        return false;
+    }
+
+    switch(inst->opcode) {
+        case EM_OP_MODE:
+            emit_store_state32(e, offsetof(em_state, mode), inst->operand.mode);
+            emit_store_state32(e, offsetof(em_state, last_mode_change), inst->index);
+            return true;
+
+        case EM_OP_CONTROL_IF:
+            // xor byte [rbx + control_flow_if_flag], 1
+            emit8(e, 0x80); emit8(e, 0xB3); emit32(e, offsetof(em_state, control_flow_if_flag)); emit8(e, 0x01);
+            return true;
+
+        case EM_OP_CONTROL_MARKER:
+        case EM_OP_NOP:
+            return true;
+    }
+
+    return false;
+}
+
+// Call the handler for whatever the instruction currently is (quickening and fusion can
+// change its opcode) and leave the trace unless it went where it did when recorded.
+// Returns where the rel32 of the exit jump is so it can be patched
+static size_t emit_call(em_emitter* e, em_instruction* inst, int32_t slot, int expected) {
+
+    // state->index = inst->index
+    emit_store_state32(e, offsetof(em_state, index), inst->index);
+
+    // mov rsi, [rbx + instructions]
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0xB3); emit32(e, offsetof(em_state, instructions));
+
+    // add rsi, slot * sizeof(em_instruction)
+    emit8(e, 0x48); emit8(e, 0x81); emit8(e, 0xC6); emit32(e, slot * sizeof(em_instruction));
+
+    // mov rdi, rbx
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);
+
+    // movzx eax, word [rsi + opcode]
+    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x86); emit32(e, offsetof(em_instruction, opcode));
+
+    // call [r12 + rax * 8]
+    emit8(e, 0x41); emit8(e, 0xFF); emit8(e, 0x14); emit8(e, 0xC4);
+
+    // cmp eax, expected
+    emit8(e, 0x3D); emit32(e, expected);
+
+    // jne exit
+    emit8(e, 0x0F); emit8(e, 0x85);
+    size_t exit_jump = e->length;
+    emit32(e, 0);
+
+    return exit_jump;
+}
+
+static em_jit* get_jit(em_state* state) {
+
+    if (state->jit == NULL) {
+        state->jit = malloc(sizeof(em_jit));
+        memset(state->jit, 0, sizeof(em_jit));
+        state->jit->recording_head = -1;
+    }
+
+    return state->jit;
+}
+
+static void stop_recording(em_state* state, em_jit* jit, bool failed) {
+
+    if (failed) {
+        log_verbose("JIT abandoned trace at %d\n", state->instructions[jit->recording_head].index);
+        state->instructions[jit->recording_head].jit.hotness = EM_JIT_NEVER;
+    }
+
+    jit->recording_head = -1;
+    jit->recorded = 0;
+}
+
+static void compile_trace(em_state* state, em_jit* jit) {
+
+    em_emitter e;
+    size_t capacity = 64 + (jit->recorded * EM_JIT_MAX_TEMPLATE);
+    e.bytes = malloc(capacity);
+    e.length = 0;
+    e.capacity = capacity;
+
+    size_t* exits = malloc(sizeof(size_t) * jit->recorded);
+    int exit_count = 0;
+
+    // push rbx; push r12; push r13 (keeps calls 16 byte aligned)
+    emit8(&e, 0x53);
+    emit8(&e, 0x41); emit8(&e, 0x54);
+    emit8(&e, 0x41); emit8(&e, 0x55);
+
+    // mov rbx, rdi (state)
+    emit8(&e, 0x48); emit8(&e, 0x89); emit8(&e, 0xFB);
+
+    // mov r12, em_op_handlers
+    emit8(&e, 0x49); emit8(&e, 0xBC); emit64(&e, (uint64_t)(uintptr_t)em_op_handlers);
+
+    size_t loop = e.length;
+
+    for (int i = 0; i < jit->recorded; i++) {
+        em_instruction* inst = &state->instructions[jit->slots[i]];
+
+        if (!emit_inline(&e, inst, jit->expected[i])) {
+            exits[exit_count++] = emit_call(&e, inst, jit->slots[i], jit->expected[i]);
+        }
+    }
+
+    // Back around the loop: jmp loop
+    emit8(&e, 0xE9);
+    size_t back = e.length;
+    emit32(&e, 0);
+    patch_rel32(&e, back, loop);
+
+    // Leave with eax (where the handler said to go) as the result
+    size_t exit = e.length;
+
+    for (int i = 0; i < exit_count; i++) {
+        patch_rel32(&e, exits[i], exit);
+    }
+
+    // pop r13; pop r12; pop rbx; ret
+    emit8(&e, 0x41); emit8(&e, 0x5D);
+    emit8(&e, 0x41); emit8(&e, 0x5C);
+    emit8(&e, 0x5B);
+    emit8(&e, 0xC3);
+
+    free(exits);
+
+    void* code = mmap(NULL, e.length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED) {
+        free(e.bytes);
+        stop_recording(state, jit, true);
+        return;
+    }
+
+    memcpy(code, e.bytes, e.length);
+    free(e.bytes);
+
+    if (mprotect(code, e.length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, e.length);
+        stop_recording(state, jit, true);
+        return;
+    }
+
+    if (jit->trace_count >= jit->max_traces) {
+        jit->max_traces = jit->max_traces == 0 ? 16 : jit->max_traces * 2;
+        jit->traces = realloc(jit->traces, sizeof(em_jit_trace) * jit->max_traces);
+    }
+
+    em_jit_trace* trace = &jit->traces[jit->trace_count++];
+    trace->code = code;
+    trace->size = e.length;
+    trace->run = (em_trace)code;
+    trace->mode = jit->recording_mode;
+    trace->control_flow_token = jit->recording_token;
+    trace->generation = jit->recording_generation;
+
+    em_instruction* head = &state->instructions[jit->recording_head];
+    head->jit.trace = jit->trace_count;
+
+    log_verbose("JIT compiled %d instructions from %d into %db\n", jit->recorded, head->index, e.length);
+
+    stop_recording(state, jit, false);
+}
+
+static void record(em_state* state, em_jit* jit, int32_t slot, int index) {
+
+    // Something was decoded: the slots recorded so far might not mean the same thing
+    if (state->decode_generation != jit->recording_generation) {
+        stop_recording(state, jit, true);
+        return;
+    }
+
+    // index is what the last recorded instruction returned to get here
+    jit->expected[jit->recorded - 1] = index;
+
+    if (slot == jit->recording_head) {
+        compile_trace(state, jit);
+        return;
+    }
+
+    // Changing the control flow symbol changes what the following code decodes to. An
+    // inner loop that already has a trace runs that instead of being recorded
+    em_instruction* inst = &state->instructions[slot];
+
+    if (jit->recorded == EM_JIT_MAX_TRACE || inst->opcode == EM_OP_CONTROL_SET_TOKEN || inst->jit.trace != 0) {
+        stop_recording(state, jit, true);
+        return;
+    }
+
+    jit->slots[jit->recorded++] = slot;
+}
+
+em_instruction* em_jit_step(em_state* state, em_instruction* inst, int index) {
+
+    em_jit* jit = get_jit(state);
+    int32_t slot = inst - state->instructions;
+
+    if (jit->recording_head != -1) {
+        record(state, jit, slot, index);
+    }
+
+    // Only loop heads (reached by going backwards) matter. state->index is still where
+    // the instruction that brought us here was
+    if (inst->index > state->index) {
+        return inst;
+    }
+
+    if (inst->jit.trace != 0) {
+        em_jit_trace* trace = &jit->traces[inst->jit.trace - 1];
+
+        if (trace->generation == state->decode_generation &&
+            trace->mode == state->mode &&
+            trace->control_flow_token == state->control_flow_token) {
+
+            int next = trace->run(state);
+
+            if (next < 0 || next >= state->len) {
+                return NULL;
+            }
+
+            return em_fetch(state, next);
+        }
+
+        // Out of date: record it again when it next gets hot
+        if (trace->generation != state->decode_generation) {
+            inst->jit.trace = 0;
+            inst->jit.hotness = 0;
+        }
+
+        return inst;
+    }
+
+    if (inst->jit.hotness == EM_JIT_NEVER || jit->recording_head != -1) {
+        return inst;
+    }
+
+    if (++inst->jit.hotness >= state->jit_threshold) {
+        jit->recording_head = slot;
+        jit->recording_mode = state->mode;
+        jit->recording_token = state->control_flow_token;
+        jit->recording_generation = state->decode_generation;
+        jit->slots[0] = slot;
+        jit->recorded = 1;
+
+        log_verbose("JIT recording trace from %d\n", inst->index);
+    }
+
+    return inst;
+}
+
+void em_jit_release(em_state* state) {
+
+    if (state->jit == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < state->jit->trace_count; i++) {
+        munmap(state->jit->traces[i].code, state->jit->traces[i].size);
+    }
+
+    free(state->jit->traces);
+    free(state->jit);
+    state->jit = NULL;
+}
+
+#else
+
+bool em_jit_available() {
+    return false;
+}
+
+em_instruction* em_jit_step(em_state* state, em_instruction* inst, int index) {
+    return inst;
+}
+
+void em_jit_release(em_state* state) {
+}
+
+#endif
\ No newline at end of file
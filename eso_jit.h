@@ -0,0 +1,21 @@
+#pragma once
+#include "eso_vm.h"
+
+// The template JIT is only built for x86-64 Linux. Build with -DESO_NO_JIT to leave it out.
+// Even when built it only runs if asked for (--jit)
+#if defined(__x86_64__) && defined(__linux__) && !defined(ESO_NO_JIT)
+    #define ESO_JIT
+#endif
+
+#define EM_JIT_DEFAULT_THRESHOLD 64
+
+// Hotness is counted in 16 bits with the top value meaning never compile
+#define EM_JIT_MAX_THRESHOLD (UINT16_MAX - 1)
+
+bool em_jit_available();
+
+// Called by the execution loop before running inst (reached by returning index).
+// Returns the instruction the interpreter should run next, NULL to stop
+em_instruction* em_jit_step(em_state* state, em_instruction* inst, int index);
+
+void em_jit_release(em_state* state);
\ No newline at end of file
@@ -7,201 +7,193 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
-#include <stdarg.h> 
+#include <stdarg.h>
 #include <stdbool.h>
 
-int run_literal(em_state* state) {
-   
-    int size_to_skip = 0;
-
-    char current_code = tolower(state->code[state->index]);
-    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", current_code);
-    log_ingestion(current_code);
-    
-    switch(current_code) {
-        case '?': 
-        {
-            int top = stack_push(state);
-            
-            char v = tolower(safe_get(state->code, state->index+1, state->len));
-
-            state->stack[top].u.v_bool = (v == 'y' || v == 't');
-            state->stack[top].code = current_code;
-
-            log_verbose("Push bool literal %c\n", v);
-        }
-        return 1;
-
-        case '1': 
-        {
-            char* test = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
-
-            if (test == NULL) {
-                em_panic(state, "Could not find a complete literal for byte: Did you forget to terminate it?");
-            }
+// Parse the text of a numeric literal once, when it's decoded, so running it is just a push.
+// terminator is the index of the ; ending the literal
+void decode_literal(em_state* state, em_instruction* inst, int start, int terminator) {
+
+    const char* text = state->code + start;
 
-            uint8_t v = 0;
+    // Anything after an embedded NUL was never part of the literal
+    uint32_t length = strnlen(text, terminator - start);
 
-            if (test[0] == 'u' && strlen(test) > 1) {
+    em_stack_item* literal = &inst->operand.literal;
+    memset(literal, 0, sizeof(em_stack_item));
+    literal->code = inst->code;
+
+    switch(inst->opcode) {
+        case EM_OP_LITERAL_U8:
+            if (length > 1 && text[0] == 'u') {
 
                 // Specifying a character code
-                v = atoi(test + 1);
-            } else {
+                literal->u.v_byte = atoi(text + 1);
+            } else if (length > 0) {
 
                 // Use ASCII value as-is
-                v = test[0];
+                literal->u.v_byte = text[0];
             }
+        break;
+
+        // None of the number parsers will read past the ;
+        case EM_OP_LITERAL_U16: literal->u.v_int16 = atoi(text); break;
+        case EM_OP_LITERAL_U32: literal->u.v_int32 = atoi(text); break;
+        case EM_OP_LITERAL_U64: literal->u.v_int64 = strtol(text, NULL, 10); break;
+        case EM_OP_LITERAL_F32: literal->u.v_float = strtod(text, NULL); break;
+        case EM_OP_LITERAL_F64: literal->u.v_double = strtod(text, NULL); break;
+    }
+}
 
-            em_parser_free(state, test);
+int run_literal_bool(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-            int top = stack_push(state);
-            state->stack[top].code = current_code;
-            state->stack[top].u.v_byte = v;
+    int top = stack_push(state);
 
-            log_verbose("Push u8 literal %d\n", v);
-        }
-        return size_to_skip;
+    char v = tolower(safe_get(state->code, state->index+1, state->len));
 
-        case '2': 
-        {
-            char* test = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+    state->stack[top].u.v_bool = (v == 'y' || v == 't');
+    state->stack[top].code = '?';
 
-            if (test == NULL) {
-                em_panic(state, "Could not find a complete literal for int16: Did you forget to terminate it?");
-            }
+    log_verbose("Push bool literal %c\n", v);
 
-            uint16_t v = atoi(test);
-            em_parser_free(state, test);
+    return inst->next;
+}
 
-            int top = stack_push(state);
-            state->stack[top].code = current_code;
-            state->stack[top].u.v_int32 = v;
+int run_literal_u8(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-            log_verbose("Push u16 literal %d\n", v);
-        }
-        return size_to_skip;
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for byte: Did you forget to terminate it?");
+    }
 
-        case '4': 
-        {
-            char* test = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+    int top = stack_push(state);
+    state->stack[top] = inst->operand.literal;
 
-            if (test == NULL) {
-                em_panic(state, "Could not find a complete literal for int32: Did you forget to terminate it?");
-            }
+    log_verbose("Push u8 literal %d\n", inst->operand.literal.u.v_byte);
 
-            uint32_t v = atoi(test);
-            em_parser_free(state, test);
+    return inst->next;
+}
 
-            int top = stack_push(state);
-            state->stack[top].code = current_code;
-            state->stack[top].u.v_int32 = v;
+int run_literal_u16(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-            log_verbose("Push u32 literal %d\n", v);
-        }
-        return size_to_skip;
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for int16: Did you forget to terminate it?");
+    }
 
-        case '8': 
-        {
-            char* test = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+    int top = stack_push(state);
+    state->stack[top] = inst->operand.literal;
 
-            if (test == NULL) {
-                em_panic(state, "Could not find a complete literal for int64: Did you forget to terminate it?");
-            }
+    log_verbose("Push u16 literal %d\n", inst->operand.literal.u.v_int16);
 
-            uint64_t v = strtol(test, NULL, 10);
-            em_parser_free(state, test);
+    return inst->next;
+}
 
-            int top = stack_push(state);
-            state->stack[top].code = current_code;
-            state->stack[top].u.v_int64 = v;
+int run_literal_u32(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-            log_verbose("Push u64 literal %llu\n", v);
-        }
-        return size_to_skip;
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for int32: Did you forget to terminate it?");
+    }
 
-        case 'f':  
-        {
-            char* test = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+    int top = stack_push(state);
+    state->stack[top] = inst->operand.literal;
 
-            if (test == NULL) {
-                em_panic(state, "Could not find a complete literal for float32: Did you forget to terminate it?");
-            }
+    log_verbose("Push u32 literal %d\n", inst->operand.literal.u.v_int32);
 
-            float v = strtod(test, NULL);
-            em_parser_free(state, test);
+    return inst->next;
+}
 
-            int top = stack_push(state);
-            state->stack[top].code = current_code;
-            state->stack[top].u.v_float = v;
+int run_literal_u64(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-            log_verbose("Push float literal %f\n", v);
-        }
-        return size_to_skip;
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for int64: Did you forget to terminate it?");
+    }
 
-        case 'd':  
-        {
-            char* test = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+    int top = stack_push(state);
+    state->stack[top] = inst->operand.literal;
 
-            if (test == NULL) {
-                em_panic(state, "Could not find a complete literal for float64: Did you forget to terminate it?");
-            }
+    log_verbose("Push u64 literal %llu\n", inst->operand.literal.u.v_int64);
 
-            double v = strtod(test, NULL);
-            em_parser_free(state, test);
+    return inst->next;
+}
 
-            int top = stack_push(state);
-            state->stack[top].code = current_code;
-            state->stack[top].u.v_double = v;
+int run_literal_f32(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-            log_verbose("Push double literal %f\n", v);
-        }
-        return size_to_skip;
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for float32: Did you forget to terminate it?");
+    }
 
-        case 's': 
-        {
-            char* text = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+    int top = stack_push(state);
+    state->stack[top] = inst->operand.literal;
 
-            if (text == NULL) {
-                em_panic(state, "Could not find a complete literal for string: Did you forget to terminate it?");
-            }
+    log_verbose("Push float literal %f\n", inst->operand.literal.u.v_float);
+
+    return inst->next;
+}
 
-            em_managed_ptr* mptr = create_managed_ptr(state);
-            mptr->raw = text;
-            mptr->size = strlen(text) + 1; //alloc until is always NUL terminated
-            mptr->concrete_type = NULL;
-            em_add_reference(state, mptr); // Stack holds a reference
+int run_literal_f64(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-            // Usercode now owns this (bookkeeping)
-            em_transfer_alloc_parser_usercode(state, mptr->size);
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for float64: Did you forget to terminate it?");
+    }
 
-            log_verbose("String push created %db managed memory for value \"%s\"\n", mptr->size, mptr->raw);
+    int top = stack_push(state);
+    state->stack[top] = inst->operand.literal;
 
-            int top = stack_push(state);
-            state->stack[top].code = current_code;
-            state->stack[top].u.v_mptr = mptr; 
+    log_verbose("Push double literal %f\n", inst->operand.literal.u.v_double);
 
-            log_verbose("Push string literal %s skip %d\n", text, size_to_skip);
-        }
-        return size_to_skip;
+    return inst->next;
+}
 
-        case '*': break;
+int run_literal_string(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
 
-        case 'n':
-        {
-            int top = stack_push(state);           
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete literal for string: Did you forget to terminate it?");
+    }
 
-            state->stack[top].u.v_mptr = state->null;
-            state->stack[top].code = 'u';
+    // Strings are mutable so every push needs its own copy of the text
+    em_managed_ptr* mptr = create_managed_ptr(state, inst->operand.text.length + 1);
+    mptr->concrete_type = NULL;
+    em_add_stack_reference(state, mptr); // Stack holds a reference
 
-            log_verbose("Push null literal\n");
-        }
-        return 0;
+    memcpy(mptr->raw, state->code + inst->operand.text.start, inst->operand.text.length);
+    ((char*)mptr->raw)[inst->operand.text.length] = 0;
 
+    log_verbose("String push created %db managed memory for value \"%s\"\n", mptr->size, mptr->raw);
 
-        default:
-            em_panic(state, "Unknown literal instruction %c", current_code);
-            return 0;
-    }
+    int top = stack_push(state);
+    state->stack[top].code = 's';
+    state->stack[top].u.v_mptr = mptr;
+
+    log_verbose("Push string literal %s resume at %d\n", mptr->raw, inst->next);
+
+    return inst->next;
+}
+
+int run_literal_null(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Literal)\n", inst->code);
+    log_ingestion(inst->code);
+
+    int top = stack_push(state);
+
+    state->stack[top].u.v_mptr = state->null;
+    state->stack[top].code = 'u';
+
+    log_verbose("Push null literal\n");
 
-    return 0;
-}
\ No newline at end of file
+    return inst->next;
+}
@@ -1,2 +1,14 @@
 #pragma once
-int run_literal(em_state* state);
\ No newline at end of file
+#include "eso_vm.h"
+
+void decode_literal(em_state* state, em_instruction* inst, int start, int terminator);
+
+int run_literal_bool(em_state* state, em_instruction* inst);
+int run_literal_u8(em_state* state, em_instruction* inst);
+int run_literal_u16(em_state* state, em_instruction* inst);
+int run_literal_u32(em_state* state, em_instruction* inst);
+int run_literal_u64(em_state* state, em_instruction* inst);
+int run_literal_f32(em_state* state, em_instruction* inst);
+int run_literal_f64(em_state* state, em_instruction* inst);
+int run_literal_string(em_state* state, em_instruction* inst);
+int run_literal_null(em_state* state, em_instruction* inst);
\ No newline at end of file
@@ -1,2 +1,10 @@
 #pragma once
-int run_memory(em_state* state);
\ No newline at end of file
+int run_memory_allocate(em_state* state, em_instruction* inst);
+int run_memory_array(em_state* state, em_instruction* inst);
+int run_memory_length(em_state* state, em_instruction* inst);
+int run_memory_elements(em_state* state, em_instruction* inst);
+int run_memory_copy(em_state* state, em_instruction* inst);
+int run_memory_set(em_state* state, em_instruction* inst);
+int run_memory_get(em_state* state, em_instruction* inst);
+int run_memory_region_open(em_state* state, em_instruction* inst);
+int run_memory_region_close(em_state* state, em_instruction* inst);
\ No newline at end of file
@@ -8,51 +8,37 @@
 #include "eso_vm.h"
 #include "eso_log.h"
 
-// Return everything in code until the specified terminator is hit.
-// The caller should resume from *resume in order to skip the eaten 
-// text and the terminator. NULL returned if terminator not found before
-// len
-char* alloc_until(em_state* state, const char* code, int index, int len, char terminator, bool eat_whitespace, int* size_to_skip) {
+// Find the index of the terminator, skipping any leading whitespace first if
+// eat_whitespace. -1 if the terminator is not found before len
+int find_until(const char* code, int index, int len, char terminator, bool eat_whitespace) {
 
-    int total_skip = 0;
     int starting_index = index;
 
-    while(eat_whitespace && isspace(code[starting_index])) {
-        total_skip++;
+    while(eat_whitespace && starting_index < len && isspace(code[starting_index])) {
         starting_index++;
     }
 
-    int bytes_consumed = 0;
-
-    for (int i = starting_index ; i < len; i++) {
-
-        log_ingestion(code[i]);
-        bytes_consumed++;
-        total_skip++;
+    for (int i = starting_index; i < len; i++) {
         if (code[i] == terminator) {
-            
-            int build_length = bytes_consumed + 1;
-            char* built = em_parser_alloc(state, build_length);
-
-            memset(built, 0, build_length);
-            memcpy(built, code+starting_index, i - starting_index);
+            return i;
+        }
+    }
 
-            built[build_length-1] = 0;
+    return -1;
+}
 
-            if (size_to_skip != NULL) {
-                if (i + 1 < len) {
-                    *size_to_skip = total_skip;
-                } else {
-                    *size_to_skip = -1;
-                }
-            }
+// FNV-1a, for the name lookup tables
+uint32_t hash_span(const char* text, int length) {
+    uint32_t hash = 2166136261u;
 
-            return built;
-        }
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
     }
 
-    if (size_to_skip != NULL) {
-        *size_to_skip = 0;
-    }
-    return NULL;
-}
\ No newline at end of file
+    return hash;
+}
+
+uint32_t hash_name(const char* name) {
+    return hash_span(name, strlen(name));
+}
@@ -1,3 +1,6 @@
 #pragma once
 
-char* alloc_until(em_state* state, const char* code, int index, int len, char terminator, bool eat_whitespace, int* size_to_skip);
\ No newline at end of file
+int find_until(const char* code, int index, int len, char terminator, bool eat_whitespace);
+
+uint32_t hash_span(const char* text, int length);
+uint32_t hash_name(const char* name);
\ No newline at end of file
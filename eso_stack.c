@@ -8,105 +8,143 @@
 #include "eso_vm.h"
 #include "eso_log.h"
 #include "eso_debug.h"
+#include "eso_stack.h"
+
+// The stack never moves, as handlers hold pointers into it across pushes. Where virtual
+// memory is available the whole of max_stack_size is reserved up front and pages are only
+// committed (and counted as permanent memory) as the stack grows into them. Everything
+// past the committed part stays inaccessible, so straying off the end faults
+#if defined(__unix__) || defined(__APPLE__)
+    #define ESO_STACK_RESERVE
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#ifdef ESO_STACK_RESERVE
+
+static size_t page_round(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
 
-// Note that this totally erases any content in the address 
-int stack_push(em_state* state) {
+// Make the first size items of the reservation usable
+static void stack_commit(em_state* state, int size) {
 
-    if ((state->stack_ptr + 1) >= state->stack_size) {
-        em_panic(state, "Stack overflow (%d maximum of %d)", state->stack_ptr, state->stack_size);
+    size_t committed = page_round(sizeof(em_stack_item) * state->stack_size);
+    size_t needed = page_round(sizeof(em_stack_item) * size);
+
+    if (needed > committed && mprotect((char*)state->stack + committed, needed - committed, PROT_READ | PROT_WRITE) != 0) {
+        em_panic(state, "Could not commit %db more stack", (int)(needed - committed));
     }
 
-    state->stack_ptr++;
+    state->memory_permanent.allocated += needed - committed;
 
-    memset(&state->stack[state->stack_ptr], 0, sizeof(em_stack_item));
-    log_verbose("Stack push result index = %d\n", state->stack_ptr);
-    return state->stack_ptr;
+    if (state->memory_permanent.allocated > state->memory_permanent.peak_allocated) {
+        state->memory_permanent.peak_allocated = state->memory_permanent.allocated;
+    }
+
+    // (Whole pages are usable once committed)
+    state->stack_size = needed / sizeof(em_stack_item);
+
+    if (state->stack_size > state->max_stack_size) {
+        state->stack_size = state->max_stack_size;
+    }
 }
 
-// Move every item in the stack up by one, freeing a slot at the bottom.
-// Use stack_push_shift_up to call stack_push properly
-void stack_shift_up(em_state* state, int index) {
+void stack_reserve(em_state* state, int size, int max_size) {
 
-    if (index < 0) {
-        return;
+    if (max_size < size) {
+        max_size = size;
     }
 
-    memcpy(&state->stack[index + 1], &state->stack[index], sizeof(em_stack_item));
-    memset(&state->stack[index], 0, sizeof(em_stack_item));
-    state->stack[index].code = '?';
+    state->max_stack_size = max_size;
+    state->stack_size = 0;
+
+    // Fresh pages are zeroed
+    state->stack = mmap(NULL, page_round(sizeof(em_stack_item) * max_size), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (state->stack == MAP_FAILED) {
+        log_printf("Could not reserve a stack of %d items\n", max_size);
+        exit(1);
+    }
 
-    return stack_shift_up(state, index - 1);
+    stack_commit(state, size);
 }
 
-void stack_push_shift_up(em_state* state) {
+void stack_release(em_state* state) {
 
-    stack_push(state);
-    stack_shift_up(state, state->stack_ptr);
+    if (state->stack != NULL) {
+        state->memory_permanent.allocated -= page_round(sizeof(em_stack_item) * state->stack_size);
+        munmap(state->stack, page_round(sizeof(em_stack_item) * state->max_stack_size));
+        state->stack = NULL;
+    }
 }
 
-void stack_shift_down(em_state* state, int index) {
+#else
 
-    state->stack[index].code = '?';
+// Without virtual memory the whole maximum is allocated up front
+static void stack_commit(em_state* state, int size) {
+    state->stack_size = state->max_stack_size;
+}
 
-    memcpy(&state->stack[index], &state->stack[index + 1], sizeof(em_stack_item));
+void stack_reserve(em_state* state, int size, int max_size) {
 
-    if (index >= state->stack_ptr) {
-        return;
+    if (max_size < size) {
+        max_size = size;
     }
 
-    stack_shift_down(state, index + 1);
+    state->max_stack_size = max_size;
+    state->stack_size = max_size;
+    state->stack = em_perma_alloc(state, sizeof(em_stack_item) * max_size);
+    memset(state->stack, 0, sizeof(em_stack_item) * max_size);
 }
 
+void stack_release(em_state* state) {
 
-// Move up every item in the stack until we hit a specific minus index and return
-// that entry (now that it's free to use because the other elements have been shifted)
-em_stack_item* stack_shift_up_index(em_state* state, int index, int stop_at_minus) {
-    
-    if (index + 1 > state->stack_ptr) {
-        stack_push(state);
+    if (state->stack != NULL) {
+        em_perma_free(state, state->stack, sizeof(em_stack_item) * state->max_stack_size);
+        state->stack = NULL;
     }
+}
 
-    memcpy(&state->stack[index + 1], &state->stack[index], sizeof(em_stack_item));
-    memset(&state->stack[index], 0, sizeof(em_stack_item));
-    state->stack[index].code = '?';
-
-    if (index == state->stack_ptr - stop_at_minus) {
-        return &state->stack[index];
-    }
+#endif
 
-    return stack_shift_up_index(state, index - 1, stop_at_minus);
-}
+// Double the room on the stack (up to max_stack_size). false if it's already there
+bool stack_grow(em_state* state) {
 
-em_stack_item* stack_insert(em_state* state, int minus) {
+    if (state->stack_size >= state->max_stack_size) {
+        return false;
+    }
 
-    int minus_as_index = state->stack_ptr - minus; // e.g. 3  -4 = -1
+    int size = state->stack_size * 2;
 
-    // Insert enough entries at the bottom of the stack if we're short
-    int missing_entries = 0;
+    if (size < 1) {
+        size = 1;
+    }
 
-    if (minus_as_index < 0) {
-        missing_entries = abs(minus_as_index);  
-    } 
+    if (size > state->max_stack_size) {
+        size = state->max_stack_size;
+    }
 
-    log_verbose("%d missing stack elements for -%d\n", missing_entries, minus);
+    log_verbose("Stack grows from %d to %d items\n", state->stack_size, size);
 
-    if (missing_entries > 0) {
+    stack_commit(state, size);
 
-        for (int missing  = 1; missing <= missing_entries; missing++) {
-            stack_push_shift_up(state);
-        }
+    return true;
+}
 
-        return &state->stack[state->stack_ptr - minus];
+// Note that this totally erases any content in the address 
+int stack_push(em_state* state) {
 
-    } else {
-        return stack_shift_up_index(state, state->stack_ptr, minus);
+    if ((state->stack_ptr + 1) >= state->stack_size && !stack_grow(state)) {
+        em_panic(state, "Stack overflow (%d maximum of %d)", state->stack_ptr, state->max_stack_size);
     }
-}
 
-void stack_drop(em_state* state, int minus) {
-    log_verbose("Drop %d\n", -minus);
-    stack_shift_down(state, state->stack_ptr - minus);
-    state->stack_ptr--;
+    state->stack_ptr++;
+
+    memset(&state->stack[state->stack_ptr], 0, sizeof(em_stack_item));
+    log_verbose("Stack push result index = %d\n", state->stack_ptr);
+    return state->stack_ptr;
 }
 
 em_stack_item* stack_pop(em_state* state) {
@@ -119,7 +157,7 @@ em_stack_item* stack_pop(em_state* state) {
 
             log_verbose("Stack pop %d is \033[0;31mremoving reference to managed memory\033[0;0m\n", state->stack_ptr);
         
-            free_managed_ptr(state, top->u.v_mptr);
+            em_drop_stack_reference(state, top->u.v_mptr);
         }
 
         state->stack_ptr--;
@@ -148,7 +186,7 @@ em_stack_item* stack_pop_preserve_top(em_state* state, int count) {
 
                 log_verbose("Stack pop %d is \033[0;31mremoving reference to managed memory\033[0;0m\n", ptr);
             
-                free_managed_ptr(state, popping->u.v_mptr);
+                em_drop_stack_reference(state, popping->u.v_mptr);
             }
 
             memset(&state->stack[ptr], 0, sizeof(em_stack_item));
@@ -201,145 +239,139 @@ bool is_stack_item_numeric(em_stack_item* item) {
 }
 
 
-int run_stack(em_state* state) {
+int run_stack_pop(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Stack)\n", inst->code);
+    log_ingestion(inst->code);
 
-    char current_code = tolower(state->code[state->index]);
+    log_verbose("Stack pop\n");
 
-    log_verbose("\033[0;31m%c\033[0;0m (Stack)\n", current_code);
-    log_ingestion(current_code);
+    if (stack_pop(state) == NULL) {
+        em_panic(state, "Cannot pop from stack: stack is empty");
+    }
 
-    switch(current_code) {
+    return inst->next;
+}
 
-        // pop
-        case 'p':         
-            log_verbose("Stack pop\n");
-            
-            if (stack_pop(state) == NULL) {
-                em_panic(state, "Cannot pop from stack: stack is empty");
-            }
+int run_stack_duplicate(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Stack)\n", inst->code);
+    log_ingestion(inst->code);
 
-            return 0;
+    em_stack_item* dup = stack_top(state);
 
-        // Duplicate top of stack
-        case 'd':
-        {
-            em_stack_item* dup = stack_top(state);
+    if (dup == NULL) {
+        em_panic(state, "Cannot duplicate stack top: stack is empty");
+    }
 
-            if (dup == NULL) {
-                em_panic(state, "Cannot duplicate stack top: stack is empty");
-            }
+    int ptr = stack_push(state);
 
-            int ptr = stack_push(state);
+    // If it's a managed memory object just create a reference
+    if (is_code_using_managed_memory(dup->code)) {
+        em_managed_ptr* reference = dup->u.v_mptr;
 
-            // If it's a managed memory object just create a reference
-            if (is_code_using_managed_memory(dup->code)) {
-                em_managed_ptr* reference = dup->u.v_mptr; 
+        if (reference != state->null) {
+            em_add_stack_reference(state, reference); // Stack holds a reference
+        }
 
-                if (reference != state->null) {
-                    em_add_reference(state, reference); // Stack holds a reference
-                }
+        state->stack[ptr].u.v_mptr = reference;
+        state->stack[ptr].code = dup->code;
 
-                state->stack[ptr].u.v_mptr = reference;
-                state->stack[ptr].code = dup->code;
+    } else {
+        memcpy(&state->stack[ptr], dup, sizeof(em_stack_item));
+    }
 
-            } else {
-                memcpy(&state->stack[ptr], dup, sizeof(em_stack_item));
-            }
-        }
-        break;
+    return inst->next;
+}
 
-        // Create a copy of an item at a specific top minus position
-        case 'c': 
-        {
-            // We need an offset at the top of the stack
-            em_stack_item* offset = stack_top(state);
+int run_stack_copy(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Stack)\n", inst->code);
+    log_ingestion(inst->code);
 
-            if (offset == NULL) {
-                em_panic(state, "Cannot copy stack item: Need offset value at stack top");
-            }
+    // We need an offset at the top of the stack
+    em_stack_item* offset = stack_top(state);
 
-            if (!is_code_numeric(offset->code)) {
-                em_panic(state, "Cannot copy stack item: Offset at stack top must be of numeric type");
-            }
+    if (offset == NULL) {
+        em_panic(state, "Cannot copy stack item: Need offset value at stack top");
+    }
 
-            uint32_t minus = 0; // Ignore the offset itself
-
-            switch(offset->code) {
-                case '1': minus += offset->u.v_byte; break;
-                case '2': minus += offset->u.v_int16; break;
-                case '4': minus += offset->u.v_int32; break;
-                case '8': 
-                     em_panic(state, "64 bit stack offsets are not currently supported (Attempt to copy with %llu)", offset->u.v_int64);
-                break;
-                default: 
-                    em_panic(state, "Unhandled type %c in determining stack copy offset", offset->code);
-                break;
-            }
+    if (!is_code_numeric(offset->code)) {
+        em_panic(state, "Cannot copy stack item: Offset at stack top must be of numeric type");
+    }
 
-            // Now actually try to get the item to copy
-            em_stack_item* to_copy = stack_top_minus(state, minus);
+    uint32_t minus = 0; // Ignore the offset itself
 
-            if (to_copy == NULL) {
-                em_panic(state, "Cannot copy stack item: Stack tells us to retrieve item at -%d to copy but no such item exists", minus);
-            }
+    switch(offset->code) {
+        case '1': minus += offset->u.v_byte; break;
+        case '2': minus += offset->u.v_int16; break;
+        case '4': minus += offset->u.v_int32; break;
+        case '8':
+             em_panic(state, "64 bit stack offsets are not currently supported (Attempt to copy with %llu)", offset->u.v_int64);
+        break;
+        default:
+            em_panic(state, "Unhandled type %c in determining stack copy offset", offset->code);
+        break;
+    }
 
-            // Pop the offset info
-            stack_pop(state);
+    // Now actually try to get the item to copy
+    em_stack_item* to_copy = stack_top_minus(state, minus);
 
-            int ptr = stack_push(state);
+    if (to_copy == NULL) {
+        em_panic(state, "Cannot copy stack item: Stack tells us to retrieve item at -%d to copy but no such item exists", minus);
+    }
 
-            // Copy is a reference 
-            if (is_code_using_managed_memory(to_copy->code)) {
-                em_managed_ptr* reference = to_copy->u.v_mptr; 
+    // Pop the offset info
+    stack_pop(state);
 
-                if (reference != state->null) {
-                    em_add_reference(state, reference); // Stack holds a reference
-                }
+    int ptr = stack_push(state);
 
-                state->stack[ptr].u.v_mptr = reference;
-                state->stack[ptr].code = to_copy->code;
+    // Copy is a reference
+    if (is_code_using_managed_memory(to_copy->code)) {
+        em_managed_ptr* reference = to_copy->u.v_mptr;
 
-            } else {
-                memcpy(&state->stack[ptr], to_copy, sizeof(em_stack_item));
-            }
+        if (reference != state->null) {
+            em_add_stack_reference(state, reference); // Stack holds a reference
         }
-        break;
 
-        case 'q': 
-        {
-            // We need an offset at the top of the stack
-            em_stack_item* offset = stack_top(state);
+        state->stack[ptr].u.v_mptr = reference;
+        state->stack[ptr].code = to_copy->code;
 
-            if (offset == NULL) {
-                em_panic(state, "Cannot pop beneath top: Need number at stack top");
-            }
+    } else {
+        memcpy(&state->stack[ptr], to_copy, sizeof(em_stack_item));
+    }
 
-            if (!is_code_numeric(offset->code)) {
-                em_panic(state, "Cannot pop beneath top: Item at stack top must be of numeric type");
-            }
+    return inst->next;
+}
 
-            uint32_t quantity = 0; 
+int run_stack_pop_beneath(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (Stack)\n", inst->code);
+    log_ingestion(inst->code);
 
-            switch(offset->code) {
-                case '1': quantity = offset->u.v_byte; break;
-                case '2': quantity = offset->u.v_int16; break;
-                case '4': quantity = offset->u.v_int32; break;
-                case '8': quantity = offset->u.v_int64; break;
-                default: 
-                    em_panic(state, "Unhandled type %c in determining stack pop quantity", offset->code);
-                break;
-            }
+    // We need an offset at the top of the stack
+    em_stack_item* offset = stack_top(state);
 
-            stack_pop(state);
+    if (offset == NULL) {
+        em_panic(state, "Cannot pop beneath top: Need number at stack top");
+    }
 
-            stack_pop_preserve_top(state, quantity);
-        }
-        break;
+    if (!is_code_numeric(offset->code)) {
+        em_panic(state, "Cannot pop beneath top: Item at stack top must be of numeric type");
+    }
 
+    uint32_t quantity = 0;
+
+    switch(offset->code) {
+        case '1': quantity = offset->u.v_byte; break;
+        case '2': quantity = offset->u.v_int16; break;
+        case '4': quantity = offset->u.v_int32; break;
+        case '8': quantity = offset->u.v_int64; break;
         default:
-            em_panic(state, "Unknown stack instruction %c", current_code);
-            return 0;
+            em_panic(state, "Unhandled type %c in determining stack pop quantity", offset->code);
+        break;
     }
 
-    return 0;
-}
\ No newline at end of file
+    stack_pop(state);
+
+    stack_pop_preserve_top(state, quantity);
+
+    return inst->next;
+}
+
@@ -1,6 +1,13 @@
 #pragma once
 #include "eso_vm.h"
 
+// Set up the stack with room for size items, able to grow to max_size
+void stack_reserve(em_state* state, int size, int max_size);
+
+bool stack_grow(em_state* state);
+
+void stack_release(em_state* state);
+
 int stack_push(em_state* state);
 
 em_stack_item* stack_pop(em_state* state);
@@ -11,10 +18,9 @@ em_stack_item* stack_top(em_state* state);
 
 bool is_stack_item_numeric(em_stack_item* item);
 
-int run_stack(em_state* state);
-
-em_stack_item* stack_pop_preserve_top(em_state* state, int count);
-
-em_stack_item* stack_insert(em_state* state, int minus);
+int run_stack_pop(em_state* state, em_instruction* inst);
+int run_stack_duplicate(em_state* state, em_instruction* inst);
+int run_stack_copy(em_state* state, em_instruction* inst);
+int run_stack_pop_beneath(em_state* state, em_instruction* inst);
 
-em_stack_item* stack_drop(em_state* state, int minus);
\ No newline at end of file
+em_stack_item* stack_pop_preserve_top(em_state* state, int count);
\ No newline at end of file
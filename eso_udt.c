@@ -11,378 +11,349 @@
 #include <stdarg.h> 
 #include <stdbool.h>
 
-int run_udt(em_state* state) {
-   
-    int size_to_skip = 0;
-
-    char current_code = tolower(state->code[state->index]);
-
-    log_verbose("\033[0;31m%c\033[0;0m (UDT)\n", current_code);
-    log_ingestion(current_code);
-
-    switch(current_code) {
+// Does the operand text of inst spell name
+static bool operand_is(em_state* state, em_instruction* inst, const char* name) {
+    return strncmp(name, state->code + inst->operand.field.start, inst->operand.field.length) == 0
+        && name[inst->operand.field.length] == 0;
+}
 
-        // Create
-        case 'c':
-        { 
-            char* name = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+// Look up the field named by the operand and remember where it is for definition.
+// Sites almost always see the same type every time, so this normally only runs once
+static void resolve_field(em_state* state, em_instruction* inst, em_type_definition* definition) {
 
-            if (name == NULL) {
-                em_panic(state, "Could not find a complete name for creating type: Did you forget to terminate it?");
-            }
+    for(int i = 0; i < strlen(definition->types); i++) {
+        if (operand_is(state, inst, definition->field_names[i])) {
+            inst->operand.field.type = definition;
+            inst->operand.field.offset = definition->start_offset_bytes[i];
+            inst->operand.field.field_code = definition->types[i];
+            return;
+        }
+    }
 
-            em_type_definition* definition = NULL;
+    em_panic(state, "No such field %.*s on type %s", inst->operand.field.length, state->code + inst->operand.field.start, definition->name);
+}
 
-            for(int t = 0; t <= state->type_ptr; t++) {
-                if (strcmp(state->types[t].name, name) == 0) {
-                    definition = &state->types[t];
-                    break;
-                }
-            }
+int run_udt_create(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (UDT)\n", inst->code);
+    log_ingestion(inst->code);
 
-            if (definition == NULL) {
-                em_panic(state, "Could not find type '%s' to create", name);
-                em_parser_free(state, name);
-            }
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete name for creating type: Did you forget to terminate it?");
+    }
 
-            em_parser_free(state, name);
+    // Types are never removed or moved, so the one found first stays correct
+    em_type_definition* definition = inst->operand.field.type;
 
-            em_managed_ptr* mptr = create_managed_ptr(state);
-            mptr->size = definition->size;
-            mptr->raw = em_usercode_alloc(state, definition->size, false);
-            memset(mptr->raw, 0, mptr->size);
-            mptr->concrete_type = definition; 
-            em_add_reference(state, mptr); // Stack holds a reference
+    for(int t = 0; definition == NULL && t <= state->type_ptr; t++) {
+        if (operand_is(state, inst, state->types[t].name)) {
+            definition = &state->types[t];
+        }
+    }
 
-            // Explicitly set user fields to null
-            for(int i = 0; i < strlen(definition->types); i++) {
-                if (is_code_using_managed_memory(definition->types[i])) {
-                    *(em_managed_ptr**)(mptr->raw + definition->start_offset_bytes[i]) = state->null;
-                }
-            }
+    if (definition == NULL) {
+        em_panic(state, "Could not find type '%.*s' to create", inst->operand.field.length, state->code + inst->operand.field.start);
+    }
 
-            int top = stack_push(state);
-            state->stack[top].code = 'u';
-            state->stack[top].u.v_mptr = mptr;
+    inst->operand.field.type = definition;
 
-            log_verbose("UDT create created %db managed memory @ %p\n", mptr->size, mptr->raw);
+    em_managed_ptr* mptr = create_managed_ptr(state, definition->size);
+    memset(mptr->raw, 0, mptr->size);
+    mptr->concrete_type = definition;
+    em_add_stack_reference(state, mptr); // Stack holds a reference
 
+    // Explicitly set user fields to null
+    for(int i = 0; i < strlen(definition->types); i++) {
+        if (is_code_using_managed_memory(definition->types[i])) {
+            *(em_managed_ptr**)(mptr->raw + definition->start_offset_bytes[i]) = state->null;
         }
-        break;
+    }
 
-        // Get a field from a UDT and push it onto the stack
-        case 'g':
-        {
-            char* name = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+    int top = stack_push(state);
+    state->stack[top].code = 'u';
+    state->stack[top].u.v_mptr = mptr;
 
-             if (name == NULL) {
-                 em_panic(state, "Could not find a complete name for a field to retrieve: Did you forget to terminate it?");
-             }
+    log_verbose("UDT create created %db managed memory @ %p\n", mptr->size, mptr->raw);
 
-            // Object of type must be on stack top
-            em_stack_item* of_type = stack_top(state);
+    return inst->next;
+}
 
-            if (of_type == NULL || of_type->code != 'u') {
-                em_panic(state, "Expected a u at stack top to get field value from type");
-            }  
+int run_udt_get(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (UDT)\n", inst->code);
+    log_ingestion(inst->code);
 
-            if (of_type->u.v_mptr == state->null) {
-                em_panic(state, "u at stack top for get field value is NULL");
-            }  
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete name for a field to retrieve: Did you forget to terminate it?");
+    }
 
-            em_type_definition* definition = of_type->u.v_mptr->concrete_type;
+    // Object of type must be on stack top
+    em_stack_item* of_type = stack_top(state);
 
-            int field_bytes_start = 0;
-            int field_size = 0;
-            char field_code = '?';
-            bool found_field = false;
+    if (of_type == NULL || of_type->code != 'u') {
+        em_panic(state, "Expected a u at stack top to get field value from type");
+    }
 
-            // Find the field by name
-            for(int i = 0; i < strlen(definition->types); i++) {
-                field_code = definition->types[i];
-                field_size = code_sizeof(field_code);
+    if (of_type->u.v_mptr == state->null) {
+        em_panic(state, "u at stack top for get field value is NULL");
+    }
 
-                if (strcmp(definition->field_names[i], name) == 0) {
-                    field_bytes_start = definition->start_offset_bytes[i];
-                    found_field = true;
-                    break;
-                }                
-            }
+    em_type_definition* definition = of_type->u.v_mptr->concrete_type;
 
-            if (!found_field) {
-                em_panic(state, "No such field %s on type %s", name, definition->name);
-            }
+    if (inst->operand.field.type != definition) {
+        resolve_field(state, inst, definition);
+    }
 
-            switch(field_code) {
-                case '?':  
-                {
-                    int top = stack_push(state);
-                    state->stack[top].u.v_bool = *(bool*)(of_type->u.v_mptr->raw + field_bytes_start);
-                    state->stack[top].code = field_code;
-                }
-                break;
-                case '1':  
-                {
-                    int top = stack_push(state);
-                    state->stack[top].u.v_byte = *(uint8_t*)(of_type->u.v_mptr->raw + field_bytes_start);
-                    state->stack[top].code = field_code;
-                }
-                break;
-                case '2':  
-                {
-                    int top = stack_push(state);
-                    state->stack[top].u.v_int16 = *(uint16_t*)(of_type->u.v_mptr->raw + field_bytes_start);
-                    state->stack[top].code = field_code;
-                }
-                break;
-                case '4':  
-                {
-                    int top = stack_push(state);
-                    state->stack[top].u.v_int32 = *(uint32_t*)(of_type->u.v_mptr->raw + field_bytes_start);
-                    state->stack[top].code = field_code;
-                }
-                break;
-                case '8':  
-                {
-                    int top = stack_push(state);
-                    state->stack[top].u.v_int64 = *(uint64_t*)(of_type->u.v_mptr->raw + field_bytes_start);
-                    state->stack[top].code = field_code;
-                }
-                break;
-                case 'f':  
-                {
-                    int top = stack_push(state);
-                    state->stack[top].u.v_float = *(float*)(of_type->u.v_mptr->raw + field_bytes_start);
-                    state->stack[top].code = field_code;
-                }
-                break;
-                case 'd':  
-                {
-                    int top = stack_push(state);
-                    state->stack[top].u.v_double = *(double*)(of_type->u.v_mptr->raw + field_bytes_start);
-                    state->stack[top].code = field_code;
-                }
-                break;
-
-                case 'u':
-                case 's': 
-                {
-                    em_managed_ptr* inside_type = *(em_managed_ptr**)(of_type->u.v_mptr->raw + field_bytes_start);
-
-                    if (inside_type == state->null) {
-
-                        int top = stack_push(state);
-                        state->stack[top].u.v_mptr = state->null;
-                        state->stack[top].code = field_code;                        
-
-                    } else {
-                        em_add_reference(state, inside_type); // Stack holds a reference
-
-                        int top = stack_push(state);
-                        state->stack[top].u.v_mptr = inside_type;
-                        state->stack[top].code = field_code;
-                    }
-                }
-                break;
-                default:
-                em_panic(state, "Getting field %s of type %c not currently supported", name, field_code);
-                break;
-            }
+    int field_bytes_start = inst->operand.field.offset;
+    char field_code = inst->operand.field.field_code;
 
+    switch(field_code) {
+        case '?':
+        {
+            int top = stack_push(state);
+            state->stack[top].u.v_bool = *(bool*)(of_type->u.v_mptr->raw + field_bytes_start);
+            state->stack[top].code = field_code;
+        }
+        break;
+        case '1':
+        {
+            int top = stack_push(state);
+            state->stack[top].u.v_byte = *(uint8_t*)(of_type->u.v_mptr->raw + field_bytes_start);
+            state->stack[top].code = field_code;
+        }
+        break;
+        case '2':
+        {
+            int top = stack_push(state);
+            state->stack[top].u.v_int16 = *(uint16_t*)(of_type->u.v_mptr->raw + field_bytes_start);
+            state->stack[top].code = field_code;
+        }
+        break;
+        case '4':
+        {
+            int top = stack_push(state);
+            state->stack[top].u.v_int32 = *(uint32_t*)(of_type->u.v_mptr->raw + field_bytes_start);
+            state->stack[top].code = field_code;
+        }
+        break;
+        case '8':
+        {
+            int top = stack_push(state);
+            state->stack[top].u.v_int64 = *(uint64_t*)(of_type->u.v_mptr->raw + field_bytes_start);
+            state->stack[top].code = field_code;
+        }
+        break;
+        case 'f':
+        {
+            int top = stack_push(state);
+            state->stack[top].u.v_float = *(float*)(of_type->u.v_mptr->raw + field_bytes_start);
+            state->stack[top].code = field_code;
+        }
+        break;
+        case 'd':
+        {
+            int top = stack_push(state);
+            state->stack[top].u.v_double = *(double*)(of_type->u.v_mptr->raw + field_bytes_start);
+            state->stack[top].code = field_code;
         }
-        return size_to_skip;
+        break;
 
-        // Set a field in a UDT from the stack
+        case 'u':
         case 's':
         {
-            char* name = alloc_until(state, state->code, state->index+1, state->len, ';', true, &size_to_skip);
+            em_managed_ptr* inside_type = *(em_managed_ptr**)(of_type->u.v_mptr->raw + field_bytes_start);
 
-             if (name == NULL) {
-                 em_panic(state, "Could not find a complete name for a field to set: Did you forget to terminate it?");
-             }
+            if (inside_type == state->null) {
 
-            // Object of type must be below value to set on stack
-            em_stack_item* of_type = stack_top_minus(state, 1);
+                int top = stack_push(state);
+                state->stack[top].u.v_mptr = state->null;
+                state->stack[top].code = field_code;
 
-            if (of_type == NULL || of_type->code != 'u') {
-                em_panic(state, "Expected a u at stack top - 1 to set field value into type");
-            }  
+            } else {
+                em_add_stack_reference(state, inside_type); // Stack holds a reference
 
-            if (of_type->u.v_mptr == state->null) {
-                em_panic(state, "u at stack top for set field value is NULL");
-            }  
+                int top = stack_push(state);
+                state->stack[top].u.v_mptr = inside_type;
+                state->stack[top].code = field_code;
+            }
+        }
+        break;
+        default:
+        em_panic(state, "Getting field %.*s of type %c not currently supported", inst->operand.field.length, state->code + inst->operand.field.start, field_code);
+        break;
+    }
 
-            em_type_definition* definition = of_type->u.v_mptr->concrete_type;
+    return inst->next;
+}
 
-            int field_bytes_start = 0;
-            int field_size = 0;
-            char field_code = '?';
-            bool found_field = false;
+int run_udt_set(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (UDT)\n", inst->code);
+    log_ingestion(inst->code);
 
-            // Find the field by name
-            for(int i = 0; i < strlen(definition->types); i++) {
-                field_code = definition->types[i];
-                field_size = code_sizeof(field_code);
+    if (inst->unterminated) {
+        em_panic(state, "Could not find a complete name for a field to set: Did you forget to terminate it?");
+    }
 
-                if (strcmp(definition->field_names[i], name) == 0) {
-                    found_field = true;
-                    field_bytes_start = definition->start_offset_bytes[i];
-                    break;
-                }
-            }
+    // Object of type must be below value to set on stack
+    em_stack_item* of_type = stack_top_minus(state, 1);
 
-            if (!found_field) {
-                em_panic(state, "No such field %s on type %s", name, definition->name);
-            }
+    if (of_type == NULL || of_type->code != 'u') {
+        em_panic(state, "Expected a u at stack top - 1 to set field value into type");
+    }
 
-            // Item on stack top must be the same type as the field we want to se
-            em_stack_item* top = stack_top(state);
-
-            if (top->code != field_code) {
-                em_panic(state, "Setting field %s requires a value of type %c on top of the stack", name, field_code);
-            }  
-
-            switch(top->code) {
-                case '?':
-                *(bool*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_bool;
-                break;
-                case '1': 
-                *(uint8_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_byte;
-                break;
-                case '2':  
-                *(uint16_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_int16;
-                break;
-                case '4':  
-                *(uint32_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_int32;
-                break;
-                case '8':  
-                *(uint64_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_int64;
-                break;
-                case 'f':  
-                *(float*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_float;
-                break;
-                case 'd':  
-                *(double*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_double;
-                break;
-
-                case 's':
-                case 'u':
-                {
-                    em_managed_ptr** field_value = (em_managed_ptr**)(of_type->u.v_mptr->raw + field_bytes_start);
-
-                    // If the field has a value, drop its references
-                    if (*field_value != state->null) {
-                        free_managed_ptr(state, *field_value);
-                    }
-
-                    em_add_reference(state, top->u.v_mptr); // Stack holds a reference
-                    *field_value = top->u.v_mptr;
-                }
-                break;
-
-                default: 
-                em_panic(state, "Setting field %s of type %c not currently supported", name, field_code);
-                break;
-            }
+    if (of_type->u.v_mptr == state->null) {
+        em_panic(state, "u at stack top for set field value is NULL");
+    }
 
-            stack_pop(state);
+    em_type_definition* definition = of_type->u.v_mptr->concrete_type;
 
-        }
-        return size_to_skip;
+    if (inst->operand.field.type != definition) {
+        resolve_field(state, inst, definition);
+    }
 
-        // Define
-        case 'd': 
-        {
-            em_stack_item* name = stack_top(state);
-            em_stack_item* field_qty = stack_top_minus(state, 1);
+    int field_bytes_start = inst->operand.field.offset;
+    char field_code = inst->operand.field.field_code;
 
-            if (name == NULL || name->code != 's') {
-                em_panic(state, "Expected an s at stack top to define the name of the type");
-            }  
+    // Item on stack top must be the same type as the field we want to se
+    em_stack_item* top = stack_top(state);
 
-            if (field_qty == NULL || field_qty->code != '4') {
-                em_panic(state, "Expected a 4 at stack top - 1 to define the quantity of fields for the type");
-            }
+    if (top->code != field_code) {
+        em_panic(state, "Setting field %.*s requires a value of type %c on top of the stack", inst->operand.field.length, state->code + inst->operand.field.start, field_code);
+    }
+
+    switch(top->code) {
+        case '?':
+        *(bool*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_bool;
+        break;
+        case '1':
+        *(uint8_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_byte;
+        break;
+        case '2':
+        *(uint16_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_int16;
+        break;
+        case '4':
+        *(uint32_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_int32;
+        break;
+        case '8':
+        *(uint64_t*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_int64;
+        break;
+        case 'f':
+        *(float*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_float;
+        break;
+        case 'd':
+        *(double*)(of_type->u.v_mptr->raw + field_bytes_start) = top->u.v_double;
+        break;
+
+        case 's':
+        case 'u':
+        {
+            em_managed_ptr** field_value = (em_managed_ptr**)(of_type->u.v_mptr->raw + field_bytes_start);
 
-            if (field_qty->u.v_int32 <= 0) {
-                em_panic(state, "Not allowed to declare type %s with no fields", name->u.v_mptr->raw);
+            // If the field has a value, drop its references
+            if (*field_value != state->null) {
+                free_managed_ptr(state, *field_value);
             }
 
-            // Currently assuming types live forever
-            //
-            em_type_definition* new_type = create_new_type(state);
+            em_add_reference(state, top->u.v_mptr); // Field holds a reference
+            *field_value = top->u.v_mptr;
+        }
+        break;
 
-            // Create a copy of the name because we don't expect it to stick around
-            new_type->name = em_perma_alloc(state, name->u.v_mptr->size);
-            memset(new_type->name, 0, name->u.v_mptr->size);
-            memcpy(new_type->name, name->u.v_mptr->raw, name->u.v_mptr->size);
+        default:
+        em_panic(state, "Setting field %.*s of type %c not currently supported", inst->operand.field.length, state->code + inst->operand.field.start, field_code);
+        break;
+    }
+
+    stack_pop(state);
 
-            new_type->types = em_perma_alloc(state, field_qty->u.v_int32 + 1);
-            memset(new_type->types, 0, field_qty->u.v_int32 + 1);
+    return inst->next;
+}
 
-            new_type->start_offset_bytes = em_perma_alloc(state, sizeof(uint32_t) * field_qty->u.v_int32);
-            memset(new_type->start_offset_bytes, 0, sizeof(uint32_t) * field_qty->u.v_int32);
+int run_udt_define(em_state* state, em_instruction* inst) {
+    log_verbose("\033[0;31m%c\033[0;0m (UDT)\n", inst->code);
+    log_ingestion(inst->code);
 
-            new_type->field_names = em_perma_alloc(state, sizeof(char*) * (field_qty->u.v_int32));
-            memset(new_type->field_names, 0, sizeof(char*) * (field_qty->u.v_int32));
+    em_stack_item* name = stack_top(state);
+    em_stack_item* field_qty = stack_top_minus(state, 1);
 
-            // We need a TYPE and NAME for each field
-            int minus = 1 + (field_qty->u.v_int32 * 2);
+    if (name == NULL || name->code != 's') {
+        em_panic(state, "Expected an s at stack top to define the name of the type");
+    }
 
-            // Where we write the type code per field
-            int type_code_ptr = 0;
+    if (field_qty == NULL || field_qty->code != '4') {
+        em_panic(state, "Expected a 4 at stack top - 1 to define the quantity of fields for the type");
+    }
 
-            uint32_t byte_start = 0;
+    if (field_qty->u.v_int32 <= 0) {
+        em_panic(state, "Not allowed to declare type %s with no fields", name->u.v_mptr->raw);
+    }
 
-            for (int field = 1; field <= field_qty->u.v_int32; field++) {
-                em_stack_item* field_name = stack_top_minus(state, minus);
+    // Currently assuming types live forever
+    //
+    em_type_definition* new_type = create_new_type(state);
 
-                if (field_name == NULL || field_name->code != 's') {
-                    em_panic(state, "Expected an s at stack top - %d to define the name of field %d of %s", minus, field, name->u.v_mptr->raw);
-                }
+    // Create a copy of the name because we don't expect it to stick around
+    new_type->name = em_perma_alloc(state, name->u.v_mptr->size);
+    memset(new_type->name, 0, name->u.v_mptr->size);
+    memcpy(new_type->name, name->u.v_mptr->raw, name->u.v_mptr->size);
 
-                // Create a copy of each field name so it can't disappear
-                char* field_name_copy = em_perma_alloc(state, field_name->u.v_mptr->size);
-                memset(field_name_copy, 0, field_name->u.v_mptr->size);
-                memcpy(field_name_copy, field_name->u.v_mptr->raw, field_name->u.v_mptr->size);
+    new_type->types = em_perma_alloc(state, field_qty->u.v_int32 + 1);
+    memset(new_type->types, 0, field_qty->u.v_int32 + 1);
 
-                new_type->field_names[field-1] = field_name_copy;
-                minus--;
+    new_type->start_offset_bytes = em_perma_alloc(state, sizeof(uint32_t) * field_qty->u.v_int32);
+    memset(new_type->start_offset_bytes, 0, sizeof(uint32_t) * field_qty->u.v_int32);
 
-                em_stack_item* field_type = stack_top_minus(state, minus);
+    new_type->field_names = em_perma_alloc(state, sizeof(char*) * (field_qty->u.v_int32));
+    memset(new_type->field_names, 0, sizeof(char*) * (field_qty->u.v_int32));
 
-                if (field_qty == NULL) {
-                    em_panic(state, "Expected an item of any type at stack top - %d to define the type of field %d of %s", minus, field, field_name_copy);
-                }
+    // We need a TYPE and NAME for each field
+    int minus = 1 + (field_qty->u.v_int32 * 2);
 
-                uint32_t naive_size = code_sizeof(field_type->code);
-                uint32_t padding_required = calculate_padding(field_type->code, byte_start);
+    // Where we write the type code per field
+    int type_code_ptr = 0;
 
-                new_type->start_offset_bytes[field-1] = byte_start + padding_required;
+    uint32_t byte_start = 0;
 
-                new_type->types[type_code_ptr] = field_type->code;
+    for (int field = 1; field <= field_qty->u.v_int32; field++) {
+        em_stack_item* field_name = stack_top_minus(state, minus);
 
-                type_code_ptr++;
-                minus--;
+        if (field_name == NULL || field_name->code != 's') {
+            em_panic(state, "Expected an s at stack top - %d to define the name of field %d of %s", minus, field, name->u.v_mptr->raw);
+        }
 
-                byte_start += (naive_size + padding_required);
-            }
+        // Create a copy of each field name so it can't disappear
+        char* field_name_copy = em_perma_alloc(state, field_name->u.v_mptr->size);
+        memset(field_name_copy, 0, field_name->u.v_mptr->size);
+        memcpy(field_name_copy, field_name->u.v_mptr->raw, field_name->u.v_mptr->size);
 
-            uint32_t aligned_size = calculate_aligned_struct_size(state, field_qty);
+        new_type->field_names[field-1] = field_name_copy;
+        minus--;
 
-            new_type->size = aligned_size;
+        em_stack_item* field_type = stack_top_minus(state, minus);
 
-            for(int q = 1; q <= 2 + (field_qty->u.v_int32 * 2); q++) {
-                stack_pop(state);
-            }
+        if (field_qty == NULL) {
+            em_panic(state, "Expected an item of any type at stack top - %d to define the type of field %d of %s", minus, field, field_name_copy);
         }
-        return size_to_skip;
 
+        uint32_t naive_size = code_sizeof(field_type->code);
+        uint32_t padding_required = calculate_padding(field_type->code, byte_start);
 
-        default:
-            em_panic(state, "Unknown UDT instruction %c", current_code);
-            return 0;
+        new_type->start_offset_bytes[field-1] = byte_start + padding_required;
+
+        new_type->types[type_code_ptr] = field_type->code;
+
+        type_code_ptr++;
+        minus--;
+
+        byte_start += (naive_size + padding_required);
+    }
+
+    uint32_t aligned_size = calculate_aligned_struct_size(state, field_qty);
+
+    new_type->size = aligned_size;
+
+    for(int q = 1; q <= 2 + (field_qty->u.v_int32 * 2); q++) {
+        stack_pop(state);
     }
 
-    return size_to_skip;
+    return inst->next;
 }
+
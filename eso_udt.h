@@ -1,4 +1,7 @@
 #pragma once
 #include "eso_vm.h"
 
-int run_udt(em_state* state);
\ No newline at end of file
+int run_udt_create(em_state* state, em_instruction* inst);
+int run_udt_get(em_state* state, em_instruction* inst);
+int run_udt_set(em_state* state, em_instruction* inst);
+int run_udt_define(em_state* state, em_instruction* inst);
\ No newline at end of file
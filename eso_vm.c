@@ -9,18 +9,27 @@
 #include "eso_log.h"
 #include "eso_debug.h"
 #include "em_c_bindings.h"
+#include "eso_parse.h"
+#include "eso_jit.h"
+#include "eso_stack.h"
+#include "eso_bytecode.h"
+#include "eso_collect.h"
 
 em_state* create_state(const char* filename) {
+    return create_state_sized(filename, EM_DEFAULT_STACK_SIZE, EM_DEFAULT_MAX_STACK_SIZE);
+}
+
+// stack_size is what the value stack starts with room for: it grows as needed up to
+// max_stack_size items
+em_state* create_state_sized(const char* filename, int stack_size, int max_stack_size) {
 
     em_state* state = em_perma_alloc(NULL, sizeof(em_state));
     memset(state, 0, sizeof(em_state));
     state->memory_permanent.allocated = sizeof(em_state); 
     state->memory_permanent.peak_allocated = sizeof(em_state); 
-    state->stack_size = 4096;
     state->stack_ptr = -1;
-    state->stack = em_perma_alloc(state, sizeof(em_stack_item) * state->stack_size);
+    stack_reserve(state, stack_size, max_stack_size);
     state->filename = filename;
-    memset(state->stack, 0, sizeof(em_stack_item) * state->stack_size);
 
     state->control_flow_token = '@';
     state->type_ptr = -1;
@@ -28,18 +37,39 @@ em_state* create_state(const char* filename) {
     state->types = em_perma_alloc(state, sizeof(em_type_definition) * state->max_types);
     memset(state->types, 0, sizeof(em_type_definition) * state->max_types);
 
-    state->c_binding_ptr = -1;
-    state->max_c_bindings = 128;
+    state->c_binding_count = 0;
+    state->max_c_bindings = 32;
     state->c_bindings = em_perma_alloc(state, sizeof(em_c_binding) * state->max_c_bindings);
     memset(state->c_bindings, 0, sizeof(em_c_binding) * state->max_c_bindings);
+    state->c_binding_table_size = 64;
+    state->c_binding_table = em_perma_alloc(state, sizeof(int32_t) * state->c_binding_table_size);
+    memset(state->c_binding_table, 0xFF, sizeof(int32_t) * state->c_binding_table_size);
 
-    state->label_ptr = -1;
-    state->max_labels = 1024;
+    state->label_count = 0;
+    state->max_labels = 64;
     state->labels = em_perma_alloc(state, sizeof(em_label) * state->max_labels);
     memset(state->labels, 0, sizeof(em_label) * state->max_labels);
 
     state->mode = EM_MEMORY;
 
+    state->instruction_ptr = -1;
+    state->markers_token = -1;
+
+    state->frame_ptr = -1;
+    state->max_frames = 64;
+    state->frames = em_perma_alloc(state, sizeof(em_call_frame) * state->max_frames);
+    state->jit_threshold = EM_JIT_DEFAULT_THRESHOLD;
+
+    state->max_pending_frees = 64;
+    state->pending_frees = em_perma_alloc(state, sizeof(em_managed_ptr*) * state->max_pending_frees);
+    state->trace_next = EM_TRACE_MINIMUM;
+
+#ifdef ESO_DEFERRED_RC
+    state->max_zero_count = 64;
+    state->zero_count = em_perma_alloc(state, sizeof(em_managed_ptr*) * state->max_zero_count);
+    state->reconcile_at = EM_ZERO_COUNT_MINIMUM;
+#endif
+
     // Setup null
     state->null = em_perma_alloc(state, sizeof(em_managed_ptr));
     memset(state->null, 0, sizeof(em_managed_ptr));
@@ -59,6 +89,10 @@ void em_add_reference(em_state* state, em_managed_ptr* mptr) {
         em_panic(state, "Attempting to add reference to the null pointer %p", state->null);
     }
 
+    if (state->tracing) {
+        return;
+    }
+
     if (mptr->references >= 65534) {
         em_panic(state, "Attempting to add 65535 references to object");
     }
@@ -66,16 +100,88 @@ void em_add_reference(em_state* state, em_managed_ptr* mptr) {
     mptr->references++;
 }
 
-void* em_perma_alloc(em_state* state, size_t size) {
-    if (state != NULL) {
-        state->memory_permanent.allocated += size;
+// Bump size bytes out of the newest chunk of arena, starting a new chunk of at least
+// chunk_size bytes when it doesn't fit. Everything handed out is 8 byte aligned
+static void* arena_alloc(em_arena_chunk** arena, size_t size, size_t chunk_size) {
 
-        if (state->memory_permanent.allocated > state->memory_permanent.peak_allocated) {
-            state->memory_permanent.peak_allocated = state->memory_permanent.allocated;
+    size_t rounded = (size + 7) & ~(size_t)7;
+    em_arena_chunk* chunk = *arena;
+
+    if (chunk == NULL || chunk->size - chunk->used < rounded) {
+
+        if (rounded > chunk_size) {
+            chunk_size = rounded;
         }
+
+        chunk = malloc(sizeof(em_arena_chunk) + chunk_size);
+        chunk->next = *arena;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        *arena = chunk;
     }
 
-    return malloc(size);
+    void* ptr = (char*)(chunk + 1) + chunk->used;
+    chunk->used += rounded;
+
+    return ptr;
+}
+
+static void arena_release(em_arena_chunk* chunk) {
+
+    while (chunk != NULL) {
+        em_arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+void* em_perma_alloc(em_state* state, size_t size) {
+
+    // The state itself
+    if (state == NULL) {
+        return malloc(size);
+    }
+
+    state->memory_permanent.allocated += size;
+
+    if (state->memory_permanent.allocated > state->memory_permanent.peak_allocated) {
+        state->memory_permanent.peak_allocated = state->memory_permanent.allocated;
+    }
+
+    return arena_alloc(&state->perma_arena, size, EM_PERMA_CHUNK_SIZE);
+}
+
+void em_perma_free(em_state* state, void* ptr, size_t size) {
+
+    if (state == NULL) {
+        free(ptr);
+        return;
+    }
+
+    state->memory_permanent.allocated -= size;
+}
+
+// Free everything the state owns. Whatever is still on the stack is released first, so
+// nothing it referenced outlives the state either
+void destroy_state(em_state* state) {
+
+    while (state->stack_ptr >= 0) {
+        stack_pop(state);
+    }
+
+    em_free_unreferenced(state);
+
+    while (state->region_depth > 0) {
+        em_release_region(state);
+    }
+
+    em_release_bytecode(state);
+    stack_release(state);
+
+    arena_release(state->perma_arena);
+
+    log_verbose("Destroyed state for %s\n", state->filename);
+    free(state);
 }
 
 void* em_usercode_alloc(em_state* state, size_t size, bool bookkeep_as_overhead) {
@@ -120,29 +226,25 @@ void em_usercode_free(em_state* state, void* ptr, size_t size, bool bookkeep_as_
     free(ptr);
 }
 
-void* em_parser_alloc(em_state* state, size_t size) {
+void* em_bytecode_alloc(em_state* state, size_t size) {
 
     if (state != NULL) {
-        state->memory_parser.allocated += size;
+        state->memory_bytecode.allocated += size;
 
-        if (state->memory_parser.allocated > state->memory_parser.peak_allocated) {
-            state->memory_parser.peak_allocated = state->memory_parser.allocated;
+        if (state->memory_bytecode.allocated > state->memory_bytecode.peak_allocated) {
+            state->memory_bytecode.peak_allocated = state->memory_bytecode.allocated;
         }
     }
 
     return malloc(size);
 }
 
-void em_transfer_alloc_parser_usercode(em_state* state, size_t size) {
-    state->memory_parser.allocated -= size;
-    state->memory_usercode.allocated += size;
+void em_bytecode_free(em_state* state, void* ptr, size_t size) {
 
-     if (state->memory_usercode.allocated > state->memory_usercode.peak_allocated) {
-        state->memory_usercode.peak_allocated = state->memory_usercode.allocated;
+    if (state != NULL) {
+        state->memory_bytecode.allocated -= size;
     }
-}
 
-void em_parser_free(em_state* state, void* ptr) {
     free(ptr);
 }
 
@@ -235,13 +337,382 @@ em_type_definition* create_new_type(em_state* state) {
     return &state->types[state->type_ptr];
 }
 
-em_managed_ptr* create_managed_ptr(em_state* state) {
+// Every string, array, raw block and UDT needs a header and most are small, so rather
+// than malloc both they're carved out of per-state slabs: anything up to
+// EM_SMALL_ALLOC_SIZE bytes is a single block with its data straight after the header
+// (raw points there), anything bigger gets a bare header and mallocs its data.
+//
+// Slabs are kept for the life of the state and so are bookkept as permanent. Headers and
+// data in use are still bookkept as usercode overhead and allocations exactly as if they
+// were allocated one at a time.
+//
+// Build with -DESO_NO_SLAB to malloc each header and its data (e.g. so ASan sees use
+// after free)
+#ifndef ESO_NO_SLAB
+
+// Smallest class with room for size bytes after the header
+static int block_class(uint32_t size) {
+
+    if (size > EM_SMALL_ALLOC_SIZE) {
+        return 0;
+    }
+
+    int fit = 1;
+
+    while ((16u << fit) < size) {
+        fit++;
+    }
+
+    return fit;
+}
+
+static size_t block_size(int block_class) {
+    return sizeof(em_managed_ptr) + (block_class == 0 ? 0 : (16u << block_class));
+}
+
+static void add_mptr_slab(em_state* state, int block_class) {
+
+    em_mptr_slab* slab = em_perma_alloc(state, EM_SLAB_SIZE);
+    slab->next = state->mptr_slabs;
+    state->mptr_slabs = slab;
+
+    size_t size = block_size(block_class);
+    int count = (EM_SLAB_SIZE - sizeof(em_mptr_slab)) / size;
+    char* blocks = (char*)(slab + 1);
+
+    slab->block_size = size;
+    slab->block_count = count;
+
+    // Free blocks have no references (the cycle collector goes by that)
+    for (int i = count - 1; i >= 0; i--) {
+        em_managed_ptr* block = (em_managed_ptr*)(blocks + (i * size));
+        memset(block, 0, sizeof(em_managed_ptr));
+        block->raw = state->free_mptrs[block_class];
+        state->free_mptrs[block_class] = block;
+    }
+
+    log_verbose("New slab of %d %db blocks\n", count, size);
+}
+
+static em_managed_ptr* allocate_block(em_state* state, uint32_t size) {
+
+    int class = block_class(size);
+
+    if (state->free_mptrs[class] == NULL) {
+        add_mptr_slab(state, class);
+    }
+
+    em_managed_ptr* ptr = state->free_mptrs[class];
+    state->free_mptrs[class] = ptr->raw;
+
+    memset(ptr, 0, sizeof(em_managed_ptr));
+    ptr->size = size;
+    ptr->block_class = class;
+
+    // Header is pure overhead
+    state->memory_usercode.overhead += sizeof(em_managed_ptr);
+
+    if (state->memory_usercode.overhead > state->memory_usercode.peak_overhead) {
+        state->memory_usercode.peak_overhead = state->memory_usercode.overhead;
+    }
+
+    if (class == 0) {
+        ptr->raw = em_usercode_alloc(state, size, false);
+        return ptr;
+    }
+
+    ptr->raw = ptr + 1;
+    state->memory_usercode.allocated += size;
+
+    if (state->memory_usercode.allocated > state->memory_usercode.peak_allocated) {
+        state->memory_usercode.peak_allocated = state->memory_usercode.allocated;
+    }
+
+    return ptr;
+}
+
+static void release_block(em_state* state, em_managed_ptr* mptr) {
+
+    int class = mptr->block_class;
+
+    if (class == 0) {
+        em_usercode_free(state, mptr->raw, mptr->size, false); // Real memory
+    } else {
+        state->memory_usercode.allocated -= mptr->size;
+    }
+
+    state->memory_usercode.overhead -= sizeof(em_managed_ptr);
+
+    memset(mptr, 0, sizeof(em_managed_ptr));
+    mptr->raw = state->free_mptrs[class];
+    state->free_mptrs[class] = mptr;
+}
+
+#else
+
+static em_managed_ptr* allocate_block(em_state* state, uint32_t size) {
     em_managed_ptr* ptr = em_usercode_alloc(state, sizeof(em_managed_ptr), true); // Pure overhead
     memset(ptr, 0, sizeof(em_managed_ptr));
+    ptr->size = size;
+    ptr->raw = em_usercode_alloc(state, size, false);
+
+    ptr->next = state->mptr_list;
+
+    if (state->mptr_list != NULL) {
+        state->mptr_list->previous = ptr;
+    }
+
+    state->mptr_list = ptr;
     return ptr;
 }
 
-void free_managed_ptr(em_state* state, em_managed_ptr* mptr) {
+static void release_block(em_state* state, em_managed_ptr* mptr) {
+
+    if (mptr->previous != NULL) {
+        mptr->previous->next = mptr->next;
+    } else {
+        state->mptr_list = mptr->next;
+    }
+
+    if (mptr->next != NULL) {
+        mptr->next->previous = mptr->previous;
+    }
+
+    em_usercode_free(state, mptr->raw, mptr->size, false); // Real memory
+    memset(mptr, 0, sizeof(em_managed_ptr));
+    em_usercode_free(state, mptr, sizeof(em_managed_ptr), true); // Overhead
+}
+
+#endif
+
+// Regions.
+//
+// Objects are still counted and freed one by one as usual, but freeing one only
+// bookkeeps it: its memory goes back with the rest of the region's chunks when the
+// region closes. A freed object keeps its size and region so the collectors can still
+// step through the chunks. Region objects are bumped even with ESO_NO_SLAB
+
+void em_open_region(em_state* state) {
+
+    if (state->region_depth == EM_MAX_REGIONS) {
+        em_panic(state, "Cannot open more than %d nested regions", EM_MAX_REGIONS);
+    }
+
+    em_region* region = &state->regions[state->region_depth++];
+    region->arena = NULL;
+    region->live = 0;
+
+    log_verbose("Opened region %d\n", state->region_depth);
+}
+
+void em_release_region(em_state* state) {
+
+    em_region* region = &state->regions[--state->region_depth];
+    arena_release(region->arena);
+    region->arena = NULL;
+
+    log_verbose("Released region %d\n", state->region_depth + 1);
+}
+
+static em_managed_ptr* allocate_managed_ptr(em_state* state, uint32_t size) {
+
+    if (state->region_depth == 0) {
+        return allocate_block(state, size);
+    }
+
+    em_region* region = &state->regions[state->region_depth - 1];
+    em_managed_ptr* ptr = arena_alloc(&region->arena, em_region_block_size(size), EM_REGION_CHUNK_SIZE);
+
+    memset(ptr, 0, sizeof(em_managed_ptr));
+    ptr->size = size;
+    ptr->region = state->region_depth;
+    ptr->raw = ptr + 1;
+    region->live++;
+
+    // Bookkept exactly as a slab block
+    state->memory_usercode.overhead += sizeof(em_managed_ptr);
+    state->memory_usercode.allocated += size;
+
+    if (state->memory_usercode.overhead > state->memory_usercode.peak_overhead) {
+        state->memory_usercode.peak_overhead = state->memory_usercode.overhead;
+    }
+
+    if (state->memory_usercode.allocated > state->memory_usercode.peak_allocated) {
+        state->memory_usercode.peak_allocated = state->memory_usercode.allocated;
+    }
+
+    return ptr;
+}
+
+void release_managed_ptr(em_state* state, em_managed_ptr* mptr) {
+
+    if (mptr->region == 0) {
+        release_block(state, mptr);
+        return;
+    }
+
+    uint32_t size = mptr->size;
+    uint8_t region = mptr->region;
+
+    state->memory_usercode.allocated -= size;
+    state->memory_usercode.overhead -= sizeof(em_managed_ptr);
+    state->regions[region - 1].live--;
+
+    memset(mptr, 0, sizeof(em_managed_ptr));
+    mptr->size = size;
+    mptr->region = region;
+}
+
+// Add mptr to a list of objects that doubles as it needs to
+static void append(em_state* state, em_managed_ptr*** list, int* count, int* max, em_managed_ptr* mptr) {
+
+    if (*count == *max) {
+        int doubled = *max * 2;
+        em_managed_ptr** grown = em_perma_alloc(state, sizeof(em_managed_ptr*) * doubled);
+
+        memcpy(grown, *list, sizeof(em_managed_ptr*) * *count);
+        em_perma_free(state, *list, sizeof(em_managed_ptr*) * *max);
+
+        *list = grown;
+        *max = doubled;
+    }
+
+    (*list)[(*count)++] = mptr;
+}
+
+#ifdef ESO_DEFERRED_RC
+
+// Deferred reference counting: stack slots aren't counted, so references only counts
+// fields and array elements and pushing, copying and popping a pointer costs nothing.
+// Every object with no counted references is instead kept in the zero count table.
+// Reconciling it against a scan of the stack frees those that aren't on the stack
+// either. That happens before allocating once the table has grown enough, and before
+// a leak check, a cycle collection or the state is destroyed (and by eb after each run)
+
+static void defer(em_state* state, em_managed_ptr* mptr) {
+
+    if (!mptr->deferred) {
+        mptr->deferred = true;
+        append(state, &state->zero_count, &state->zero_count_size, &state->max_zero_count, mptr);
+    }
+}
+
+static void mark_stack(em_state* state, bool on_stack) {
+
+    for (int i = 0; i <= state->stack_ptr; i++) {
+        em_stack_item* item = &state->stack[i];
+
+        if (is_code_using_managed_memory(item->code) && item->u.v_mptr != state->null) {
+            item->u.v_mptr->on_stack = on_stack;
+        }
+    }
+}
+
+void em_reconcile(em_state* state) {
+
+    mark_stack(state, true);
+    state->reconciling = true;
+
+    int kept = 0;
+
+    for (int i = 0; i < state->zero_count_size; i++) {
+        em_managed_ptr* mptr = state->zero_count[i];
+
+        if (mptr->references == 0 && mptr->on_stack) {
+            state->zero_count[kept++] = mptr;
+            continue;
+        }
+
+        mptr->deferred = false;
+
+        if (mptr->references == 0) {
+
+            if (mptr->size == 0) {
+                em_panic(state, "Attempting to free allocation of zero size: Unlikely to be legitimate allocation");
+            }
+
+            append(state, &state->pending_frees, &state->pending_free_count, &state->max_pending_frees, mptr);
+        }
+    }
+
+    state->zero_count_size = kept;
+
+    // Anything that loses its last reference as these go and isn't on the stack goes too
+    em_drain_frees(state, 0);
+
+    state->reconciling = false;
+    mark_stack(state, false);
+
+    state->reconcile_at = (state->zero_count_size * 2) + EM_ZERO_COUNT_MINIMUM;
+    log_verbose("Reconciled deferred references: %d objects only on the stack\n", state->zero_count_size);
+}
+
+#else
+
+void em_reconcile(em_state* state) {
+}
+
+#endif
+
+void em_free_unreferenced(em_state* state) {
+
+    if (state->tracing) {
+        em_trace_heap(state);
+        return;
+    }
+
+    em_reconcile(state);
+    em_drain_frees(state, 0);
+}
+
+em_managed_ptr* create_managed_ptr(em_state* state, uint32_t size) {
+
+    // Cycles are collected before allocating rather than at any other point, so nothing
+    // a handler is part way through building is ever mistaken for garbage
+    if (state->collect_threshold != 0 && state->memory_usercode.allocated >= state->collect_next) {
+        em_collect_cycles(state);
+
+        state->collect_next = state->memory_usercode.allocated * 2;
+
+        if (state->collect_next < state->collect_threshold) {
+            state->collect_next = state->collect_threshold;
+        }
+    }
+
+    if (state->tracing) {
+
+        if (state->memory_usercode.allocated + state->memory_usercode.overhead >= state->trace_next) {
+            em_trace_heap(state);
+        }
+
+        // Never counted again: a reference just marks the block as in use
+        em_managed_ptr* mptr = allocate_managed_ptr(state, size);
+        mptr->references = 1;
+        return mptr;
+    }
+
+#ifdef ESO_DEFERRED_RC
+    if (state->zero_count_size >= state->reconcile_at) {
+        em_reconcile(state);
+    }
+
+    // Nothing counts the stack slot it's about to be pushed into
+    em_managed_ptr* mptr = allocate_managed_ptr(state, size);
+    defer(state, mptr);
+    return mptr;
+#else
+    return allocate_managed_ptr(state, size);
+#endif
+}
+
+// Objects are freed from a queue rather than by recursing into whatever they refer to,
+// so dropping the last reference to a long list or a big array of strings can't run
+// out of C stack. With a free budget only that many objects are freed per drop and the
+// rest are left for the next one: the queue is always emptied before a leak check or
+// when the state is destroyed (and by eb after each run)
+
+// Drop a reference to mptr, queuing it to be freed if that was the last one
+static void drop_reference(em_state* state, em_managed_ptr* mptr) {
 
     if (mptr == state->null) {
         em_panic(state, "Attempting to free the null pointer %p", state->null);
@@ -254,83 +725,254 @@ void free_managed_ptr(em_state* state, em_managed_ptr* mptr) {
     mptr->references--;
     log_verbose("Freeing %p now at %d references\n", mptr->raw, mptr->references);
 
-    if (mptr->references <= 0) {
+    if (mptr->references > 0) {
+        return;
+    }
 
-        // If we're actually a reference of something else, then free that
-        log_verbose("Freeing %db of memory @ %p\n", mptr->size, mptr->raw);
+#ifdef ESO_DEFERRED_RC
+    // Still on the stack, or might be: only a reconcile can tell
+    if (!state->reconciling || mptr->on_stack) {
+        defer(state, mptr);
+        return;
+    }
+#endif
 
-        if (mptr->concrete_type != NULL) {
-            log_verbose("Need to free fields of concrete type %s\n", mptr->concrete_type->name);
+    append(state, &state->pending_frees, &state->pending_free_count, &state->max_pending_frees, mptr);
+}
+
+void em_visit_references(em_state* state, em_managed_ptr* mptr, em_visit visit) {
 
-            for(int field = 0; field < strlen(mptr->concrete_type->types); field++) {
+    if (mptr->concrete_type != NULL) {
 
-                if (is_code_using_managed_memory(mptr->concrete_type->types[field])) {
+        for(int field = 0; field < strlen(mptr->concrete_type->types); field++) {
 
-                    log_verbose("Freeing field %s of %s (%p +%db)\n", mptr->concrete_type->field_names[field], mptr->concrete_type->name, mptr->raw, mptr->concrete_type->start_offset_bytes[field]);
+            if (is_code_using_managed_memory(mptr->concrete_type->types[field])) {
 
-                    em_managed_ptr* to_free = *(em_managed_ptr**)(mptr->raw + mptr->concrete_type->start_offset_bytes[field]);
+                em_managed_ptr* field_value = *(em_managed_ptr**)(mptr->raw + mptr->concrete_type->start_offset_bytes[field]);
 
-                    log_verbose("Resolves to %p\n", to_free);
+                log_verbose("Field %s of %s (%p +%db) resolves to %p\n", mptr->concrete_type->field_names[field], mptr->concrete_type->name, mptr->raw, mptr->concrete_type->start_offset_bytes[field], field_value);
 
-                    if (to_free == state->null) {
-                        log_verbose("Resolved to NULL: Not initialized nothing to free\n", to_free);
-                    } else {
-                        free_managed_ptr(state, to_free);
-                    }
+                if (field_value != state->null) {
+                    visit(state, field_value);
                 }
             }
         }
+    }
 
-        // If this is an array, we need to free any objects it references
-        if (mptr->is_array && is_code_using_managed_memory(mptr->array_element_code)) {
+    if (mptr->is_array && is_code_using_managed_memory(mptr->array_element_code)) {
 
-            for (int i = 0; i < (mptr->size / mptr->array_element_size); i++) {
-                 em_managed_ptr* element = (((em_managed_ptr**) mptr->raw)[i]);
+        for (int i = 0; i < (mptr->size / mptr->array_element_size); i++) {
+             em_managed_ptr* element = (((em_managed_ptr**) mptr->raw)[i]);
 
-                 if (element != state->null) {
-                    free_managed_ptr(state, element);
-                 }
-            }
+             if (element != state->null) {
+                visit(state, element);
+             }
         }
+    }
+}
 
-        em_usercode_free(state, mptr->raw, mptr->size, false); // Real memory
-        memset(mptr, 0, sizeof(em_managed_ptr));       
-        em_usercode_free(state, mptr, sizeof(em_managed_ptr), true); // Overhead
+// Free an object nothing refers to any more, dropping its references to anything else
+static void free_unreferenced(em_state* state, em_managed_ptr* mptr) {
+    log_verbose("Freeing %db of memory @ %p\n", mptr->size, mptr->raw);
+
+    em_visit_references(state, mptr, drop_reference);
+    release_managed_ptr(state, mptr);
+}
+
+// Free up to budget queued objects (0 for all of them)
+void em_drain_frees(em_state* state, int budget) {
+
+    int freed = 0;
+
+    while (state->pending_free_count > 0 && (budget == 0 || freed < budget)) {
+        free_unreferenced(state, state->pending_frees[--state->pending_free_count]);
+        freed++;
     }
 }
 
-uint32_t calculate_file_line(em_state* state) {
-    uint32_t line = 1;
-    for(int i = 0; i < state->index; i++) {
-        if (state->code[i] == '\n') {
-            line++;
+void free_managed_ptr(em_state* state, em_managed_ptr* mptr) {
+
+    // Whatever isn't reachable any more is found by the next trace
+    if (state->tracing) {
+
+        if (mptr == state->null) {
+            em_panic(state, "Attempting to free the null pointer %p", state->null);
+        }
+
+        if (mptr->size == 0) {
+            em_panic(state, "Attempting to free allocation of zero size: Unlikely to be legitimate allocation");
         }
+
+        return;
     }
-    return line;
+
+    drop_reference(state, mptr);
+    em_drain_frees(state, state->free_budget);
 }
 
-uint32_t calculate_file_column(em_state* state) {
-    uint32_t column = 1;
-    for(int i = 0; i < state->index; i++) {
+void release_newlines(em_state* state) {
+
+    if (state->newlines != NULL) {
+        em_bytecode_free(state, state->newlines, sizeof(int32_t) * (state->newline_count + 1));
+        state->newlines = NULL;
+    }
+
+    state->newline_count = 0;
+}
+
+// Record where every newline in the code is, so positions can be converted
+// to and from lines without scanning from the start each time
+static void index_newlines(em_state* state) {
+
+    if (state->newlines != NULL || state->code == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < state->len; i++) {
         if (state->code[i] == '\n') {
-            column = 1;
+            state->newline_count++;
+        }
+    }
+
+    // One extra for the end of the code, so there's always something allocated
+    state->newlines = em_bytecode_alloc(state, sizeof(int32_t) * (state->newline_count + 1));
+    state->newlines[state->newline_count] = state->len;
+
+    int newline = 0;
+
+    for (int i = 0; i < state->len; i++) {
+        if (state->code[i] == '\n') {
+            state->newlines[newline++] = i;
+        }
+    }
+}
+
+// How many newlines come before index
+static int count_newlines_before(em_state* state, int index) {
+
+    index_newlines(state);
+
+    int low = 0;
+    int high = state->newline_count;
+
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+
+        if (state->newlines[middle] < index) {
+            low = middle + 1;
         } else {
-            column++;
+            high = middle;
         }
     }
-    return column;
+
+    return low;
 }
 
+uint32_t calculate_file_line(em_state* state) {
+    return count_newlines_before(state, state->index) + 1;
+}
+
+uint32_t calculate_file_column(em_state* state) {
+    int line = count_newlines_before(state, state->index);
+
+    if (line == 0) {
+        return state->index + 1;
+    }
+
+    return state->index - state->newlines[line - 1];
+}
+
+// The index of the newline that starts line (i.e. the end of the line before it),
+// -1 if there is no such line
+int32_t find_line_start(em_state* state, uint32_t line) {
+
+    index_newlines(state);
+
+    if (line < 2 || line - 2 >= state->newline_count) {
+        return -1;
+    }
+
+    return state->newlines[line - 2];
+}
+
+uint32_t count_file_lines(em_state* state) {
+    index_newlines(state);
+    return state->newline_count + 1;
+}
+
+// The table slot holding name, or the empty slot it would go in
+static int32_t* find_c_binding_slot(em_state* state, int32_t* table, int table_size, const char* name, uint32_t hash) {
+    uint32_t mask = table_size - 1;
+
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        int32_t binding = table[i];
+
+        if (binding == -1) {
+            return &table[i];
+        }
+
+        if (state->c_bindings[binding].hash == hash && strcmp(state->c_bindings[binding].name, name) == 0) {
+            return &table[i];
+        }
+    }
+}
+
+em_c_binding* em_find_c_binding(em_state* state, const char* name) {
+    int32_t binding = *find_c_binding_slot(state, state->c_binding_table, state->c_binding_table_size, name, hash_name(name));
+
+    return binding == -1 ? NULL : &state->c_bindings[binding];
+}
+
+static void grow_c_bindings(em_state* state) {
+
+    // Bindings array: indices stay the same so call sites can keep them
+    int max_c_bindings = state->max_c_bindings * 2;
+    em_c_binding* c_bindings = em_perma_alloc(state, sizeof(em_c_binding) * max_c_bindings);
+    memset(c_bindings, 0, sizeof(em_c_binding) * max_c_bindings);
+    memcpy(c_bindings, state->c_bindings, sizeof(em_c_binding) * state->c_binding_count);
+
+    em_perma_free(state, state->c_bindings, sizeof(em_c_binding) * state->max_c_bindings);
+    state->c_bindings = c_bindings;
+    state->max_c_bindings = max_c_bindings;
+
+    // Table: kept at twice the number of bindings it can hold
+    int table_size = state->c_binding_table_size * 2;
+    int32_t* table = em_perma_alloc(state, sizeof(int32_t) * table_size);
+    memset(table, 0xFF, sizeof(int32_t) * table_size);
+
+    for (int i = 0; i < state->c_binding_count; i++) {
+        *find_c_binding_slot(state, table, table_size, c_bindings[i].name, c_bindings[i].hash) = i;
+    }
+
+    em_perma_free(state, state->c_binding_table, sizeof(int32_t) * state->c_binding_table_size);
+    state->c_binding_table = table;
+    state->c_binding_table_size = table_size;
+
+    log_verbose("C binding table grown to %d\n", max_c_bindings);
+}
+
+// Binding a name again replaces the function it calls
 void em_bind_c_call(em_state* state, char* name, em_c_call call) {
-     state->c_binding_ptr++;
+     uint32_t hash = hash_name(name);
+     int32_t* slot = find_c_binding_slot(state, state->c_binding_table, state->c_binding_table_size, name, hash);
 
-     em_c_binding* bind = &state->c_bindings[state->c_binding_ptr];
+     if (*slot == -1) {
 
-     bind->name = em_perma_alloc(state, strlen(name) + 1);
-     memset(bind->name, 0, strlen(name) + 1);
-     memcpy(bind->name, name, strlen(name));
+        if (state->c_binding_count >= state->max_c_bindings) {
+            grow_c_bindings(state);
+            slot = find_c_binding_slot(state, state->c_binding_table, state->c_binding_table_size, name, hash);
+        }
+
+        *slot = state->c_binding_count++;
 
+        em_c_binding* bind = &state->c_bindings[*slot];
+        bind->name = em_perma_alloc(state, strlen(name) + 1);
+        memcpy(bind->name, name, strlen(name) + 1);
+        bind->hash = hash;
+     }
+
+     em_c_binding* bind = &state->c_bindings[*slot];
      bind->bound = call;
 
      log_verbose("Bound C method '%s' @ %p\n", bind->name, call);
-}
\ No newline at end of file
+}
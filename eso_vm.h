@@ -16,6 +16,117 @@ typedef enum {
 
 } ESOMODE;
 
+// Sequences the bytecode compiler runs as a single instruction
+typedef enum {
+    EM_FUSION_ADD_IMMEDIATE,    // ml <n>; mb +
+    EM_FUSION_GET_LABEL,        // ml s <name>; mf g
+    EM_FUSION_STACK_COPY,       // ml <n>; ms c
+    EM_FUSION_COMPARE_BRANCH,   // mb < or > then mf < or > (optionally with i before it)
+
+    EM_FUSION_COUNT
+} ESOFUSION;
+
+// Instructions as decoded by the bytecode compiler (see eso_bytecode.c)
+// Each maps onto exactly one run_* handler
+typedef enum {
+    EM_OP_MODE,
+
+    EM_OP_LITERAL_BOOL,
+    EM_OP_LITERAL_U8,
+    EM_OP_LITERAL_U16,
+    EM_OP_LITERAL_U32,
+    EM_OP_LITERAL_U64,
+    EM_OP_LITERAL_F32,
+    EM_OP_LITERAL_F64,
+    EM_OP_LITERAL_STRING,
+    EM_OP_LITERAL_NULL,
+
+    EM_OP_BOOLEAN_ADD,
+    EM_OP_BOOLEAN_AND,
+    EM_OP_BOOLEAN_OR,
+    EM_OP_BOOLEAN_NOT,
+    EM_OP_BOOLEAN_LESS,
+    EM_OP_BOOLEAN_GREATER,
+
+    // Typed forms the add/less/greater sites are quickened into (same order of types for each)
+    EM_OP_BOOLEAN_ADD_U8,
+    EM_OP_BOOLEAN_ADD_U16,
+    EM_OP_BOOLEAN_ADD_U32,
+    EM_OP_BOOLEAN_ADD_U64,
+    EM_OP_BOOLEAN_ADD_F32,
+    EM_OP_BOOLEAN_ADD_F64,
+    EM_OP_BOOLEAN_LESS_U8,
+    EM_OP_BOOLEAN_LESS_U16,
+    EM_OP_BOOLEAN_LESS_U32,
+    EM_OP_BOOLEAN_LESS_U64,
+    EM_OP_BOOLEAN_LESS_F32,
+    EM_OP_BOOLEAN_LESS_F64,
+    EM_OP_BOOLEAN_GREATER_U8,
+    EM_OP_BOOLEAN_GREATER_U16,
+    EM_OP_BOOLEAN_GREATER_U32,
+    EM_OP_BOOLEAN_GREATER_U64,
+    EM_OP_BOOLEAN_GREATER_F32,
+    EM_OP_BOOLEAN_GREATER_F64,
+
+    EM_OP_MEMORY_ALLOCATE,
+    EM_OP_MEMORY_ARRAY,
+    EM_OP_MEMORY_LENGTH,
+    EM_OP_MEMORY_ELEMENTS,
+    EM_OP_MEMORY_COPY,
+    EM_OP_MEMORY_SET,
+    EM_OP_MEMORY_GET,
+    EM_OP_MEMORY_REGION_OPEN,
+    EM_OP_MEMORY_REGION_CLOSE,
+
+    EM_OP_STACK_POP,
+    EM_OP_STACK_DUPLICATE,
+    EM_OP_STACK_COPY,
+    EM_OP_STACK_POP_BENEATH,
+
+    EM_OP_C_CALL,
+
+    EM_OP_DEBUG_STACK,
+    EM_OP_DEBUG_TRACE,
+    EM_OP_DEBUG_TYPES,
+    EM_OP_DEBUG_MEMORY,
+    EM_OP_DEBUG_INSPECT,
+    EM_OP_DEBUG_ASSERT_LINE,
+    EM_OP_DEBUG_ASSERT,
+    EM_OP_DEBUG_FUSIONS,
+    EM_OP_DEBUG_COLLECT,
+
+    EM_OP_UDT_CREATE,
+    EM_OP_UDT_GET,
+    EM_OP_UDT_SET,
+    EM_OP_UDT_DEFINE,
+
+    EM_OP_CONTROL_MARKER,
+    EM_OP_CONTROL_EXIT,
+    EM_OP_CONTROL_LABEL,
+    EM_OP_CONTROL_FORWARD_DECLARE,
+    EM_OP_CONTROL_JUMP,
+    EM_OP_CONTROL_GET_LABEL,
+    EM_OP_CONTROL_IF,
+    EM_OP_CONTROL_LINE,
+    EM_OP_CONTROL_SET_TOKEN,
+    EM_OP_CONTROL_REWIND,
+    EM_OP_CONTROL_FAST_FORWARD,
+    EM_OP_CONTROL_CALL,
+    EM_OP_CONTROL_RETURN,
+
+    // Several instructions run as one (see eso_fusion.c)
+    EM_OP_FUSED_ADD_IMMEDIATE,
+    EM_OP_FUSED_GET_LABEL,
+    EM_OP_FUSED_STACK_COPY,
+    EM_OP_FUSED_COMPARE_BRANCH,
+
+    EM_OP_NOP,
+    EM_OP_UNKNOWN,
+
+    EM_OP_COUNT
+
+} ESOOPCODE;
+
 typedef struct {
     char* name;
     char* types;
@@ -25,22 +136,46 @@ typedef struct {
 } em_type_definition;
 
 typedef struct {
-    char* name;
+    char* name; // NULL if the slot is empty
+    uint32_t hash;
     uint32_t location;
 } em_label;
 
-typedef struct {
+typedef struct t_em_managed_ptr {
     void* raw;
     uint32_t size;
-    uint16_t references; // strong references
+    uint16_t references; // strong references (not counting the stack with ESO_DEFERRED_RC)
+    uint8_t block_class; // Which slab blocks this came from (see create_managed_ptr)
+    uint8_t region;      // Region it was allocated in counting from 1, or 0 for none
+    bool deferred;       // In the zero count table (ESO_DEFERRED_RC)
     em_type_definition* concrete_type;
 
     bool is_array;
+    bool on_stack;       // Found on the stack by the reconcile in progress (ESO_DEFERRED_RC)
     uint32_t array_element_size;
     char array_element_code;
+
+    // Scratch for the cycle collector (see eso_collect.c)
+    bool gc_reachable;
+    uint16_t gc_references;
+
+#ifdef ESO_NO_SLAB
+    // Without slabs to find them in, every live object is on state->mptr_list
+    struct t_em_managed_ptr* previous;
+    struct t_em_managed_ptr* next;
+#endif
 } em_managed_ptr;
 
-typedef struct {
+// Stack items are a one byte code and an 8 byte value, which the value's alignment pads
+// out to 16 bytes. Build with -DESO_PACKED_STACK to pack them into 9 instead: less memory
+// to move around for every push, copy and dump at the cost of unaligned values
+#ifdef ESO_PACKED_STACK
+    #define EM_STACK_ITEM_LAYOUT __attribute__((packed))
+#else
+    #define EM_STACK_ITEM_LAYOUT
+#endif
+
+typedef struct EM_STACK_ITEM_LAYOUT {
     char code;
     union {
         bool v_bool;
@@ -54,6 +189,13 @@ typedef struct {
     } u;
 } em_stack_item;
 
+// A call in progress (see run_control_call)
+typedef struct {
+    int32_t return_to;          // Where mf r resumes from (less one)
+    int32_t base;               // Stack index of the location that was called
+    uint32_t argument_count;
+} em_call_frame;
+
 typedef struct {
 
     // Currently allocated
@@ -68,6 +210,110 @@ typedef struct {
 struct t_em_c_binding;
 typedef struct t_em_c_binding em_c_binding;
 
+struct t_em_jit;
+typedef struct t_em_jit em_jit;
+
+// Permanent allocations are bumped out of chunks of at least EM_PERMA_CHUNK_SIZE bytes
+#define EM_PERMA_CHUNK_SIZE 32768
+
+typedef struct t_em_arena_chunk {
+    struct t_em_arena_chunk* next;
+    size_t size;
+    size_t used;
+} em_arena_chunk;
+
+// Managed allocations made while a region is open (mm ( to mm )) are bumped out of its
+// chunks as header then data, and all go at once when it closes. live is how many of
+// them haven't been freed
+#define EM_MAX_REGIONS 16
+#define EM_REGION_CHUNK_SIZE 16384
+
+typedef struct {
+    em_arena_chunk* arena;
+    uint32_t live;
+} em_region;
+
+// Bytes a region object of size bytes takes up in its chunk
+static inline size_t em_region_block_size(uint32_t size) {
+    return (sizeof(em_managed_ptr) + size + 7) & ~(size_t)7;
+}
+
+// Managed allocations of up to EM_SMALL_ALLOC_SIZE bytes are one block holding the
+// em_managed_ptr header and then the data. Blocks come in classes by how much data they
+// have room for: class 0 is a bare header whose data is allocated separately
+#define EM_SMALL_ALLOC_SIZE 256
+#define EM_BLOCK_CLASSES 5
+#define EM_SLAB_SIZE 16384
+
+// EM_SLAB_SIZE bytes of blocks all of one class
+typedef struct t_em_mptr_slab {
+    struct t_em_mptr_slab* next;
+    uint32_t block_size;
+    uint32_t block_count;
+} em_mptr_slab;
+
+typedef struct {
+    uint16_t opcode;
+    char code;              // Source character the instruction was decoded from
+
+    // What the instruction was decoded under: if either differs at runtime
+    // the instruction is decoded again
+    ESOMODE mode;
+    uint8_t control_flow_token;
+
+    uint32_t index;         // Source index (diagnostics and handlers)
+    uint32_t next;          // Source index to resume from (after any operand)
+
+    // A ; terminated operand had no terminator: handler panics when run
+    bool unterminated;
+
+    union {
+        ESOMODE mode;
+        em_stack_item literal;  // Pushed as-is
+
+        // Where in the source a ; terminated operand's text lives
+        struct {
+            uint32_t start;
+            uint32_t length;
+        } text;
+
+        uint32_t line;
+
+        // Resolved destination of a rewind/fast-forward (see eso_controlflow.c)
+        int32_t target;
+
+        // Index of the C binding this call site last called, -1 if none yet
+        int32_t binding;
+
+        // UDT name/field operand text, and what it last resolved to (see eso_udt.c)
+        struct {
+            uint32_t start;
+            uint32_t length;
+            em_type_definition* type; // NULL until resolved
+            int32_t offset;
+            char field_code;
+        } field;
+    } operand;
+
+    // Only used when this instruction starts a fused sequence (see eso_fusion.c)
+    struct {
+        uint16_t opcode;        // What this instruction is on its own
+        uint32_t next;          // Source index after the whole sequence
+        uint32_t mode_change;   // Source index of the last mode change in it
+        uint32_t branch;        // Source index of the rewind/fast-forward
+        int32_t target;         // Resolved destination of the branch
+        uint32_t hash;          // Of a constant label name
+        bool toggles_if;        // Contains mf i
+        bool backwards;         // Branch is a rewind rather than a fast-forward
+    } fused;
+
+    // Loop head bookkeeping for the template JIT (see eso_jit.c)
+    struct {
+        uint16_t hotness;       // Times reached by jumping backwards
+        uint16_t trace;         // Compiled trace starting here + 1 (0 if none)
+    } jit;
+} em_instruction;
+
 typedef struct em_state_forward {
     em_type_definition* types;
     int type_ptr;
@@ -75,23 +321,31 @@ typedef struct em_state_forward {
 
     em_stack_item* stack;
     int stack_ptr;
-    int stack_size;
+    int stack_size;         // Items the stack has room for now
+    int max_stack_size;     // Items it may grow to (see stack_grow)
+
+    em_call_frame* frames; // Calls that haven't returned, innermost last
+    int frame_ptr;
+    int max_frames;
     int last_mode_change;
     const char* filename;
     bool control_flow_if_flag;
     uint8_t control_flow_token;
 
-    em_c_binding* c_bindings;
+    em_c_binding* c_bindings; // In the order they were bound
     int max_c_bindings;
-    int c_binding_ptr;
+    int c_binding_count;
+    int32_t* c_binding_table; // Open addressed hash of name -> c_bindings index (-1 if empty)
+    int c_binding_table_size; // Always a power of 2
 
-    em_label* labels;
-    int max_labels;
-    int label_ptr;
+    em_label* labels; // Open addressed hash table keyed on name
+    int max_labels; // Always a power of 2
+    int label_count;
 
     em_memory_use memory_permanent;
     em_memory_use memory_usercode;
     em_memory_use memory_parser;
+    em_memory_use memory_bytecode;
 
     ESOMODE mode;
 
@@ -99,8 +353,83 @@ typedef struct em_state_forward {
     int len;
     int index;
 
+    // Decoded form of code
+    em_instruction* instructions;
+    int instruction_ptr;
+    int max_instructions;
+
+    // Per source index: which instruction executes from here (-1 if not decoded)
+    int32_t* instruction_at;
+    int instruction_at_size;
+
+    // Ascending positions of control_flow_token in code (built on demand)
+    int32_t* markers;
+    int marker_count;
+    int markers_token; // Symbol markers was built for, -1 if not built
+
+    // Per fusion: sites fused, times run, and times its guard failed
+    uint32_t fusion_sites[EM_FUSION_COUNT];
+    uint64_t fusion_runs[EM_FUSION_COUNT];
+    uint64_t fusion_fallbacks[EM_FUSION_COUNT];
+
+    // Ascending positions of every newline in code (built on demand)
+    int32_t* newlines;
+    int newline_count;
+
+    // Bumped whenever em_decode writes an instruction
+    uint32_t decode_generation;
+
+    // Template JIT (see eso_jit.c): off unless asked for
+    bool jit_enabled;
+    int jit_threshold; // Backward jumps to an instruction before a trace is compiled from it
+    em_jit* jit;
+
     em_managed_ptr* null;
 
+    // Objects with no references left that haven't been freed yet (see free_managed_ptr)
+    em_managed_ptr** pending_frees;
+    int pending_free_count;
+    int max_pending_frees;
+    int free_budget; // Most objects one free_managed_ptr frees, 0 for no limit
+
+    // Objects with no counted references that might still be on the stack, and how big
+    // that can get before it's reconciled (ESO_DEFERRED_RC, see em_reconcile)
+    em_managed_ptr** zero_count;
+    int zero_count_size;
+    int max_zero_count;
+    int reconcile_at;
+    bool reconciling;
+
+    // Tracing instead of counting references (see em_trace_heap): garbage is found by marking
+    // everything reachable from the stack once usercode memory passes trace_next
+    bool tracing;
+    uint32_t trace_next;
+
+    // Cycle collection (see eso_collect.c): objects still to be scanned, and how many
+    // usercode bytes can be allocated before collecting (collect_threshold 0 for never)
+    em_managed_ptr** collect_work;
+    int collect_work_count;
+    int max_collect_work;
+    uint32_t collect_threshold;
+    uint32_t collect_next;
+
+    // Where em_perma_alloc allocates from, newest chunk first. It all goes at once with
+    // the state (see destroy_state)
+    em_arena_chunk* perma_arena;
+
+    // Every em_managed_ptr comes out of these slabs. Freed blocks go on the free list
+    // for their class, linked through their raw pointer
+    em_mptr_slab* mptr_slabs;
+    em_managed_ptr* free_mptrs[EM_BLOCK_CLASSES];
+
+#ifdef ESO_NO_SLAB
+    em_managed_ptr* mptr_list;
+#endif
+
+    // Open regions, innermost last
+    em_region regions[EM_MAX_REGIONS];
+    int region_depth;
+
 } em_state;
 
 typedef void (*em_c_call) (em_state* state);
@@ -108,11 +437,19 @@ typedef void (*em_c_call) (em_state* state);
 struct t_em_c_binding {
 
     char* name;
+    uint32_t hash;
     em_c_call bound;
 
 };
 
+// Items the value stack starts with room for and can grow to by default. Anything
+// embedding the VM can pick its own with create_state_sized (eb: --stack-size=n and
+// --max-stack-size=n)
+#define EM_DEFAULT_STACK_SIZE 1024
+#define EM_DEFAULT_MAX_STACK_SIZE 4096
+
 em_state* create_state();
+em_state* create_state_sized(const char* filename, int stack_size, int max_stack_size);
 void destroy_state(em_state* state);
 
 void em_panic(em_state* state, const char* format, ...);
@@ -122,27 +459,62 @@ bool is_code_using_managed_memory(char code);
 char safe_get(const char* code, int index, int len);
 
 em_type_definition* create_new_type(em_state* state);
-em_managed_ptr* create_managed_ptr(em_state* state);
+em_managed_ptr* create_managed_ptr(em_state* state, uint32_t size);
 void free_managed_ptr(em_state* state, em_managed_ptr* mptr);
+void em_drain_frees(em_state* state, int budget);
 
-void* em_perma_alloc(em_state* state, size_t size);
+// Free everything that has no references left (however they're counted)
+void em_free_unreferenced(em_state* state);
+void em_reconcile(em_state* state);
+
+// Give back mptr's header and data regardless of its references
+void release_managed_ptr(em_state* state, em_managed_ptr* mptr);
+
+// Start allocating from a new region, or give back the innermost one's chunks once
+// every object allocated in it has been freed
+void em_open_region(em_state* state);
+void em_release_region(em_state* state);
 
-// Allocations that should not live forever that are temporary values
-// for parsing
-void* em_parser_alloc(em_state* state, size_t size);
-void em_parser_free(em_state* state, void* ptr);
+// Call visit for each (non null) object mptr's fields or elements refer to
+typedef void (*em_visit)(em_state* state, em_managed_ptr* mptr);
+void em_visit_references(em_state* state, em_managed_ptr* mptr, em_visit visit);
+
+// Allocations that live as long as the state. Freeing one only bookkeeps it: the
+// memory itself goes back with the rest of them in destroy_state
+void* em_perma_alloc(em_state* state, size_t size);
+void em_perma_free(em_state* state, void* ptr, size_t size);
 
 // Allocations that should NOT live forever
 void* em_usercode_alloc(em_state* state, size_t size, bool bookkeep_as_overhead);
 void em_usercode_free(em_state* state, void* ptr, size_t size, bool bookkeep_as_overhead);
 
-// This is just for bookkeeping to say usercode now owns something originally owned
-// by the parser
-void em_transfer_alloc_parser_usercode(em_state* state, size_t size);
+// Allocations for the decoded instruction stream: live as long as the code they were decoded from
+void* em_bytecode_alloc(em_state* state, size_t size);
+void em_bytecode_free(em_state* state, void* ptr, size_t size);
 
 uint32_t calculate_file_line(em_state* state);
 uint32_t calculate_file_column(em_state* state);
+int32_t find_line_start(em_state* state, uint32_t line);
+uint32_t count_file_lines(em_state* state);
+void release_newlines(em_state* state);
 
 void em_bind_c_call(em_state* state, char* name, em_c_call call);
+em_c_binding* em_find_c_binding(em_state* state, const char* name);
+
+void em_add_reference(em_state* state, em_managed_ptr* mptr);
+
+// Build with -DESO_DEFERRED_RC to stop counting references held by stack slots: objects
+// nothing else refers to are found by scanning the stack instead (see em_reconcile)
+#define EM_ZERO_COUNT_MINIMUM 256
+
+static inline void em_add_stack_reference(em_state* state, em_managed_ptr* mptr) {
+#ifndef ESO_DEFERRED_RC
+    em_add_reference(state, mptr);
+#endif
+}
 
-void em_add_reference(em_state* state, em_managed_ptr* mptr);
\ No newline at end of file
+static inline void em_drop_stack_reference(em_state* state, em_managed_ptr* mptr) {
+#ifndef ESO_DEFERRED_RC
+    free_managed_ptr(state, mptr);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+# Time every program in bench/ against interpreters built with different flags
+#
+# e.g. ./go-bench.sh "" "-DESO_SWITCH_DISPATCH"
+#
+# With no arguments the default build is compared against the switch dispatch loop
+
+variants=("$@")
+
+if [ ${#variants[@]} -eq 0 ]; then
+    variants=("" "-DESO_SWITCH_DISPATCH")
+fi
+
+TIMEFORMAT="%Rs"
+
+for i in "${!variants[@]}"; do
+    ${CC:-clang} -O2 ${variants[$i]} *.c -o "eb-bench$i" || exit 1
+done
+
+for file in bench/*.eb
+do
+    echo "********** $file **********"
+
+    for i in "${!variants[@]}"; do
+        printf "%-40s" "[${variants[$i]:-default}]"
+        time ("./eb-bench$i" "$file" > /dev/null || echo "FAILED")
+    done
+done
+
+rm -f eb-bench*
@@ -0,0 +1,41 @@
+# Translates every test to C with eb --emit-c, builds it against the runtime and checks
+# it gives the same result as interpreting it
+mkdir -p /tmp/eb-emit-c
+runtime=$(ls *.c | grep -v '^main.c$')
+
+${CC:-cc} -c $CFLAGS $runtime || exit 1
+mv *.o /tmp/eb-emit-c/
+
+failed=0
+compared=0
+
+for file in tests/**/*.{pass,fail}
+do
+    ./eb --emit-c "$file" > /tmp/eb-emit-c/program.c || exit 1
+    ${CC:-cc} $CFLAGS -I. /tmp/eb-emit-c/program.c /tmp/eb-emit-c/*.o -o /tmp/eb-emit-c/program || exit 1
+
+    # Addresses differ from run to run and between the two binaries. So do the bytes
+    # stdio.print_bytes prints for anything holding addresses (an array of s, u or *)
+    ./eb "$file" > /tmp/eb-emit-c/interpreted 2>&1
+    interpreted_status=$?
+    sed -i -E 's/0x[0-9a-fA-F]*//g; s/([0-9]+b with addresses = )[-0-9,]*/\1/g' /tmp/eb-emit-c/interpreted
+
+    /tmp/eb-emit-c/program > /tmp/eb-emit-c/compiled 2>&1
+    compiled_status=$?
+    sed -i -E 's/0x[0-9a-fA-F]*//g; s/([0-9]+b with addresses = )[-0-9,]*/\1/g' /tmp/eb-emit-c/compiled
+
+    ((compared+=1))
+
+    if ! cmp -s /tmp/eb-emit-c/interpreted /tmp/eb-emit-c/compiled || [ $interpreted_status -ne $compiled_status ]; then
+        printf "\e[31m********** $file differs compiled to C (exit $interpreted_status vs $compiled_status) **********\e[39m\n"
+        diff -a /tmp/eb-emit-c/interpreted /tmp/eb-emit-c/compiled
+        ((failed+=1))
+    fi
+done
+
+if [ $failed -ne 0 ]; then
+    printf "\e[31m************* $failed of $compared cases differ *************\e[39m\n"
+    exit 1
+fi
+
+printf "\e[32m************* $compared cases match *************\e[39m\n"
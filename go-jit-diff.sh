@@ -0,0 +1,39 @@
+# Runs every test interpreted and with the JIT compiling every loop it can (threshold 1)
+# and checks both give the same result
+failed=0
+compared=0
+
+# Addresses differ from run to run unless address space randomisation is off. Bytes
+# printed by stdio.print_bytes can be addresses too (an array of s, u or *), so both
+# sides run without it where setarch can do that
+norandom=""
+
+if setarch "$(uname -m)" -R true 2>/dev/null; then
+    norandom="setarch $(uname -m) -R"
+fi
+
+for file in tests/**/*.{pass,fail}
+do
+    $norandom ./eb "$file" --no-jit > /tmp/eb-interpreted 2>&1
+    interpreted_status=$?
+    sed -i 's/0x[0-9a-fA-F]*//g' /tmp/eb-interpreted
+
+    $norandom ./eb "$file" --jit --jit-threshold=1 > /tmp/eb-jitted 2>&1
+    jitted_status=$?
+    sed -i 's/0x[0-9a-fA-F]*//g' /tmp/eb-jitted
+
+    ((compared+=1))
+
+    if ! cmp -s /tmp/eb-interpreted /tmp/eb-jitted || [ $interpreted_status -ne $jitted_status ]; then
+        printf "\e[31m********** $file differs under --jit (exit $interpreted_status vs $jitted_status) **********\e[39m\n"
+        diff -a /tmp/eb-interpreted /tmp/eb-jitted
+        ((failed+=1))
+    fi
+done
+
+if [ $failed -ne 0 ]; then
+    printf "\e[31m************* $failed of $compared cases differ *************\e[39m\n"
+    exit 1
+fi
+
+printf "\e[32m************* $compared cases match *************\e[39m\n"
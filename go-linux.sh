@@ -1,18 +1,21 @@
 passed=0
 
+# Every case runs with reference counting and again with the tracing heap
 for file in tests/**/*.{pass,fail}
 do
-    echo "********** $file **********"
+for mode in "" "--tracing"
+do
+    echo "********** $file $mode **********"
    
     # Case should be OK
     if [[ $file == *.pass ]]; then
-        ./eb "$file" || exit 1
+        ./eb "$file" $mode || exit 1
         printf "\e[32m*************OK*************\e[39m\n"
         ((passed+=1))
     else 
 
         # Case should fail
-        ./eb "$file"
+        ./eb "$file" $mode
 
         if [ $? -eq 0 ]; then
             printf "\n\e[31m*************EXPECTED CASE TO FAIL BUT IT PASSED*************\e[39m\n\n"
@@ -22,6 +25,7 @@ do
             ((passed+=1))
         fi
     fi
+done
 done 
 
 printf "\e[32m************* $passed cases passed *************\e[39m\n"
@@ -7,7 +7,6 @@
 // How to unwrap c strings out ahead of c calls?
 // Control flow should not seek to comments or the same symbol when set
 // Signed is broken (unsigned everywhere)
-// Fix perma allocs so they are freeable before exit
 
 #include <stdlib.h>
 #include <string.h>
@@ -29,9 +28,25 @@
 #include "eso_debug.h"
 #include "eso_controlflow.h"
 #include "eso_c.h"
+#include "eso_bytecode.h"
+#include "eso_jit.h"
+#include "eso_emit.h"
 #include <string.h>
 
-em_state* run_file(const char* file, bool do_assert_no_leak);
+typedef struct {
+    bool interactive;
+    bool jit;
+    int jit_threshold;
+    int stack_size;
+    int max_stack_size;
+    int free_budget;
+    int collect_threshold;
+    bool tracing;
+} run_options;
+
+em_state* load_file(const char* file, int* size, run_options* options);
+em_state* run_file(const char* file, bool do_assert_no_leak, run_options* options);
+void emit_c_file(const char* file);
 void run(em_state* state);
 void repl(em_state* state);
 
@@ -43,14 +58,63 @@ int main(int argc, char** argv) {
         repl(state);
     }
 
-    bool interactive_mode = (argc >= 3 && strcmp(argv[2], "--i") == 0);
+    // eb --emit-c file.eb writes the program out as C instead of running it
+    if (strcmp(argv[1], "--emit-c") == 0) {
 
-    em_state* state = run_file(argv[1], !interactive_mode); // Only do leak check if not interactive
+        if (argc < 3) {
+            log_printf("Usage: eb --emit-c file.eb\n");
+            exit(1);
+        }
+
+        emit_c_file(argv[2]);
+        return 0;
+    }
+
+    run_options options = { false, false, EM_JIT_DEFAULT_THRESHOLD, EM_DEFAULT_STACK_SIZE, EM_DEFAULT_MAX_STACK_SIZE, 0, 0, false };
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--i") == 0) {
+            options.interactive = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.jit = true;
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            options.jit = false;
+        } else if (strncmp(argv[i], "--jit-threshold=", 16) == 0) {
+            options.jit_threshold = atoi(argv[i] + 16);
+
+            if (options.jit_threshold > EM_JIT_MAX_THRESHOLD) {
+                log_printf("--jit-threshold can be at most %d\n", EM_JIT_MAX_THRESHOLD);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--stack-size=", 13) == 0) {
+            options.stack_size = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--max-stack-size=", 17) == 0) {
+            options.max_stack_size = atoi(argv[i] + 17);
+        } else if (strncmp(argv[i], "--free-budget=", 14) == 0) {
+            options.free_budget = atoi(argv[i] + 14);
+        } else if (strcmp(argv[i], "--tracing") == 0) {
+            options.tracing = true;
+        } else if (strncmp(argv[i], "--collect-threshold=", 20) == 0) {
+            options.collect_threshold = atoi(argv[i] + 20);
+        } else {
+            log_printf("Unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (options.jit && !em_jit_available()) {
+        log_verbose("JIT not available in this build: interpreting\n");
+        options.jit = false;
+    }
+
+    em_state* state = run_file(argv[1], !options.interactive, &options); // Only do leak check if not interactive
 
-    if (state != NULL && interactive_mode) {
+    if (state != NULL && options.interactive) {
         repl(state);
     }
 
+    destroy_state(state);
+
     return 0;
 }
 
@@ -76,7 +140,7 @@ void repl(em_state* state) {
 }
 
 
-em_state* run_file(const char* file, bool do_assert_no_leak) {
+em_state* load_file(const char* file, int* size, run_options* options) {
     FILE* input = fopen(file, "rb");
 
     if (input == NULL) {
@@ -91,7 +155,7 @@ em_state* run_file(const char* file, bool do_assert_no_leak) {
 
     rewind(input);
 
-    em_state* state = create_state(file);
+    em_state* state = create_state_sized(file, options->stack_size, options->max_stack_size);
 
     char* file_content = em_perma_alloc(state, length+1);
     memset(file_content, 0, length+1);
@@ -106,121 +170,48 @@ em_state* run_file(const char* file, bool do_assert_no_leak) {
     state->code = file_content;
     state->len = strlen(file_content);
 
-    run(state);
-
-    if (do_assert_no_leak) {
-        assert_no_leak(state);
-    }
-
     fclose(input);
+
+    *size = length;
     return state;
 }
 
-void run(em_state* state) {
-
-    bool premature_exit = false;
+em_state* run_file(const char* file, bool do_assert_no_leak, run_options* options) {
+    int size = 0;
+    em_state* state = load_file(file, &size, options);
 
-    for (int i = 0; i < state->len; i++) {
+    state->jit_enabled = options->jit;
+    state->jit_threshold = options->jit_threshold < 1 ? 1 : options->jit_threshold;
+    state->free_budget = options->free_budget < 0 ? 0 : options->free_budget;
+    state->collect_threshold = options->collect_threshold < 0 ? 0 : options->collect_threshold;
+    state->collect_next = state->collect_threshold;
+    state->tracing = options->tracing;
 
-        state->index = i;
-
-        if (premature_exit) {
-            break;
-        }
-
-        if (state->code[i] == '#') {
-            log_verbose("Terminating at comment at index %d\n", i);
-
-            for(int current = i; current < state->len; current++) {
-                if (state->code[current] == '\n') {
-                    i = current - 1;
-                    break;
-                }
-            }
-
-            continue;
-        }
-
-        if (isspace(state->code[i]) || state->code[i] == '\r') {
-            continue;
-        }
+    run(state);
 
-        // 'Free letters' i.e. top level mode changes
-        switch(tolower(state->code[i])) {
+    if (do_assert_no_leak) {
+        assert_no_leak(state);
+    }
 
-            // Change mode
-            case 'm': {
+    return state;
+}
 
-                log_ingestion(state->code[i]);
+void emit_c_file(const char* file) {
+    run_options options = { false, false, EM_JIT_DEFAULT_THRESHOLD, EM_DEFAULT_STACK_SIZE, EM_DEFAULT_MAX_STACK_SIZE, 0, 0, false };
 
-                char new_mode = safe_get(state->code, i+1, state->len);
-                state->last_mode_change = i;
+    int size = 0;
+    em_state* state = load_file(file, &size, &options);
 
-                log_ingestion(new_mode);
+    em_compile(state);
+    em_emit_c(state, stdout, size);
 
-                switch(tolower(new_mode)) {
-                    case 'b': state->mode = EM_BOOLEAN; break;
-                    case 'm': state->mode = EM_MEMORY; break;
-                    case 'l': state->mode = EM_LITERAL; break;
-                    case 's': state->mode = EM_STACK; break;
-                    case 'c': state->mode = EM_CC; break;
-                    case 'd': state->mode = EM_DEBUG; break;
-                    case 'u': state->mode = EM_UDT; break;
-                    case 'f': state->mode = EM_CONTROL_FLOW; break;
-                default:
-                    em_panic(state, "Unknown mode change '%c'\n", new_mode);
-                    break;
-                }
+    destroy_state(state);
+}
 
-                log_verbose("\033[0;31m%c %c\033[0;0m (Mode change)\n", state->code[i], new_mode);
+void run(em_state* state) {
+    em_compile(state);
+    em_execute(state, 0);
 
-                i++;
-                continue;
-            }
-            break;
-
-            default:
-            {               
-                int skip = 0;
-
-                #ifdef ESO_VERBOSE_DEBUG
-                    log_verbose("---------------------------- %d:%d\n", calculate_file_line(state), calculate_file_column(state));
-                #endif
-
-                // Allow modes to eat text
-                switch(state->mode) {
-                    case EM_MEMORY: skip = run_memory(state); break;
-                    case EM_LITERAL: skip = run_literal(state); break;
-                    case EM_STACK: skip = run_stack(state); break;
-                    case EM_CC: skip = run_c(state); break;
-                    case EM_DEBUG: skip = run_debug(state); break;
-                    case EM_BOOLEAN: skip = run_boolean(state); break;
-                    case EM_UDT: skip = run_udt(state); break;
-
-                    // Unlike other modes control flow directly sets where
-                    // we resume from
-                    case EM_CONTROL_FLOW: 
-                        i = run_control(state);
-
-                        if (i == -1) {
-                            premature_exit = true;
-                        }
-
-                        continue;
-                }
-
-                log_verbose("Skipping %d characters\n", skip);
-
-                if (skip >= 0) {
-                    i += skip;
-                } else {
-                    log_verbose("EOF reached detected by skip of %d\n", skip);
-                    premature_exit = true;
-                }
-
-                break;
-            }
-        }       
-       
-    }
+    // Finish off anything a free budget (or deferred counting) left
+    em_free_unreferenced(state);
 }
\ No newline at end of file